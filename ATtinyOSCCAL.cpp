@@ -0,0 +1,204 @@
+/* This file has been prepared for Doxygen automatic documentation generation.*/
+/*! \file *********************************************************************
+ *
+ * \brief
+ *      Arduino library interface to the synchronization code.
+ *
+ *      The lock is reported to the sketch through its own bit in
+ *      synchLockEvent, so the interrupt service routines do the same work as
+ *      in the other builds. The onLock callback is called from update(), in
+ *      the context of loop(). See ATtinyOSCCAL.h.
+ *
+ * \par Application note:
+ *      AVR054 Synchronization of the internal RC oscillator
+ *
+ ******************************************************************************/
+
+#include "ATtinyOSCCAL.h"
+
+extern "C" {
+#include "online_synch.h"
+#include "device_specific.h"
+#include "compiler.h"
+
+extern unsigned char breakDetected;
+extern unsigned char synchLockEvent;
+extern unsigned char synchLockOSCCAL;
+extern signed int synchLockError;
+}
+
+// Receive buffer, written by UART_RXC_ISR. The size must be a power of 2.
+#define RECEIVE_BUFFER_SIZE   16
+#define RECEIVE_BUFFER_MASK   (RECEIVE_BUFFER_SIZE - 1)
+
+static volatile unsigned char receiveBuffer[RECEIVE_BUFFER_SIZE];
+static volatile unsigned char receiveHead;
+static volatile unsigned char receiveTail;
+
+ATtinyOSCCALClass ATtinyOSCCAL;
+
+/*! \brief Store a character received outside of a synchronization.
+ *
+ *  Called from UART_RXC_ISR. The character is dropped if the buffer is full.
+ */
+extern "C" void ATtinyOSCCAL_Receive(unsigned char data)
+{
+    unsigned char head = (receiveHead + 1) & RECEIVE_BUFFER_MASK;
+
+    if (head != receiveTail)
+    {
+        receiveBuffer[receiveHead] = data;
+        receiveHead = head;
+    }
+}
+
+/*! \brief Start the synchronization.
+ *
+ *  The baud rate is fixed at compile time by SYNCH_FREQUENCY and SYNCH_UBRR
+ *  in online_synch.h, as the timer counts are derived from it.
+ *
+ *  \return  false if baud does not match SYNCH_FREQUENCY.
+ */
+bool ATtinyOSCCALClass::begin(unsigned long baud)
+{
+    if (baud != SYNCH_FREQUENCY)
+    {
+        return false;
+    }
+
+    __disable_interrupt();
+    lockSeen = false;
+    synchLockEvent &= ~LOCK_EVENT_USER;
+    Initialize_Synchronization();
+    __enable_interrupt();
+    return true;
+}
+
+/*! \brief Run the work of the main loop.
+ *
+ *  Must be called regularly from loop(). Never waits. Calls the onLock
+ *  callback once for each completed synchronization, and runs drift and
+ *  supply tracking when they are enabled in online_synch.h.
+ */
+void ATtinyOSCCALClass::update(void)
+{
+    unsigned char lockOSCCAL;
+
+    if (synchLockEvent & LOCK_EVENT_USER)
+    {
+        __disable_interrupt();
+        lockOSCCAL = OSCCAL;
+        synchLockEvent &= ~LOCK_EVENT_USER;
+        __enable_interrupt();
+
+        lockSeen = true;
+        if (lockCallback != 0)
+        {
+            lockCallback(lockOSCCAL);
+        }
+    }
+
+#if defined(DRIFT_TRACKING)
+    Synch_Update_Drift();
+#endif
+#if defined(RESYNCH_REPORT)
+    Synch_Report_Resynch();
+#endif
+#if defined(SUPPLY_TRACKING)
+    Synch_Update_Supply();
+#endif
+#if defined(SYNCH_TRACE)
+    Synch_Trace_Send();
+#endif
+}
+
+/*! \brief Synchronization state, without waiting.
+ *
+ *  \return  ATTINYOSCCAL_UNLOCKED, ATTINYOSCCAL_CALIBRATING or
+ *           ATTINYOSCCAL_LOCKED.
+ */
+unsigned char ATtinyOSCCALClass::state(void)
+{
+    if (breakDetected)
+    {
+        return ATTINYOSCCAL_CALIBRATING;
+    }
+    if (lockSeen || (synchLockEvent & LOCK_EVENT_USER))
+    {
+        return ATTINYOSCCAL_LOCKED;
+    }
+    return ATTINYOSCCAL_UNLOCKED;
+}
+
+bool ATtinyOSCCALClass::isLocked(void)
+{
+    return state() == ATTINYOSCCAL_LOCKED;
+}
+
+/*! \brief Set the function called by update() after each lock.
+ *
+ *  The function gets the OSCCAL value of the lock. Pass 0 to remove it.
+ */
+void ATtinyOSCCALClass::onLock(LockCallback callback)
+{
+    lockCallback = callback;
+}
+
+unsigned char ATtinyOSCCALClass::osccal(void)
+{
+    return OSCCAL;
+}
+
+/*! \brief Estimated frequency error at the current OSCCAL value.
+ *
+ *  The count error of the last lock measurement, moved to the current OSCCAL
+ *  value with OSCCAL_STEP_PERMILLE. The resolution is one timer count, that
+ *  is 1000000 / (TARGET_FREQUENCY / SYNCH_FREQUENCY) ppm. A positive value
+ *  means that the clock runs fast.
+ *
+ *  \return  Frequency error in ppm, 0 before the first lock.
+ */
+long ATtinyOSCCALClass::residualPPM(void)
+{
+    unsigned char lockOSCCAL;
+    signed int lockError;
+    signed long error16;
+
+    if (!isLocked())
+    {
+        return 0;
+    }
+
+    __disable_interrupt();
+    lockOSCCAL = synchLockOSCCAL;
+    lockError = synchLockError;
+    __enable_interrupt();
+
+    error16 = ((signed long)lockError * 16) +
+              ((signed long)((signed int)OSCCAL - lockOSCCAL) *
+               OSCCAL_STEP_COUNT16);
+    return (error16 * 62500L) / (TARGET_FREQUENCY / SYNCH_FREQUENCY);
+}
+
+/*! \brief Number of received characters in the buffer. */
+int ATtinyOSCCALClass::available(void)
+{
+    return (receiveHead - receiveTail) & RECEIVE_BUFFER_MASK;
+}
+
+/*! \brief Next received character.
+ *
+ *  \return  The character, or -1 if the buffer is empty.
+ */
+int ATtinyOSCCALClass::read(void)
+{
+    unsigned char data;
+
+    if (receiveHead == receiveTail)
+    {
+        return -1;
+    }
+    data = receiveBuffer[receiveTail];
+    receiveTail = (receiveTail + 1) & RECEIVE_BUFFER_MASK;
+    return data;
+}
@@ -0,0 +1,72 @@
+/* This file has been prepared for Doxygen automatic documentation generation.*/
+/*! \file *********************************************************************
+ *
+ * \brief
+ *      Arduino library interface to the synchronization code.
+ *
+ *      The synchronization source code is built unchanged by the Arduino IDE
+ *      as part of this library, with ARDUINO defined. Its interrupt service
+ *      routines run in the background, so the sketch keeps running its loop
+ *      while a synchronization is in progress. The method, baud rate and
+ *      options are selected in online_synch.h as for the other builds.
+ *
+ *      \code
+ *      void locked(unsigned char osccal) { ... }
+ *
+ *      void setup()
+ *      {
+ *          ATtinyOSCCAL.onLock(locked);
+ *          ATtinyOSCCAL.begin(19200);
+ *      }
+ *
+ *      void loop()
+ *      {
+ *          ATtinyOSCCAL.update();
+ *          ...
+ *      }
+ *      \endcode
+ *
+ *      The library owns the USART receiver and INT0, so Serial can not be
+ *      used. Received characters are read with available() and read().
+ *      Timer/Counter0 is shared with millis(), which stops during each
+ *      synchronization, as do the PWM outputs of Timer/Counter0.
+ *
+ * \par Application note:
+ *      AVR054 Synchronization of the internal RC oscillator
+ *
+ ******************************************************************************/
+
+#if !defined(_ATTINYOSCCAL_H_)
+#define _ATTINYOSCCAL_H_
+
+// Values returned by ATtinyOSCCALClass::state().
+#define ATTINYOSCCAL_UNLOCKED      0   // No synchronization has completed.
+#define ATTINYOSCCAL_CALIBRATING   1   // A BREAK has been received.
+#define ATTINYOSCCAL_LOCKED        2
+
+class ATtinyOSCCALClass
+{
+public:
+    typedef void (*LockCallback)(unsigned char osccal);
+
+    bool begin(unsigned long baud);
+    void update(void);
+
+    unsigned char state(void);
+    bool isLocked(void);
+    void onLock(LockCallback callback);
+
+    unsigned char osccal(void);
+    long residualPPM(void);
+
+    int available(void);
+    int read(void);
+
+private:
+    LockCallback lockCallback;
+    bool lockSeen;
+};
+
+extern ATtinyOSCCALClass ATtinyOSCCAL;
+
+#endif
@@ -0,0 +1,271 @@
+/* This file has been prepared for Doxygen automatic documentation generation.*/
+/*! \file *********************************************************************
+ *
+ * \brief
+ *      Implementation of the auto synch byte method.
+ *
+ *      This file contain the implementation of the auto SYNCH byte
+ *      synchronization method, which takes the number of SYNCH bytes from
+ *      each header. The first SYNCH byte runs the binary search with the
+ *      tolerance window of the single SYNCH byte method. The UART receiver is
+ *      then enabled, and the next character is measured by a neighbor search
+ *      around the result while it is received. UART_RXC_ISR in synch_uart.c
+ *      completes the synchronization at its stop bit: a second SYNCH byte
+ *      gives the best neighbor, any other character is passed on as data
+ *      with the result of the first SYNCH byte. The number of SYNCH bytes in
+ *      the last header is in synchHeaderBytes.
+ *
+ *      Measurements more than AUTO_HEADER_LIMIT from the target end the
+ *      neighbor search at once, so OSCCAL stays within a few steps of the
+ *      first result while a data byte is received.
+ *
+ * \par Application note:
+ *      AVR054 Synchronization of the internal RC oscillator
+ *
+ ******************************************************************************/
+
+#include "online_synch.h"
+#include "device_specific.h"
+#include "compiler.h"
+
+#if defined(SYNCH_METHOD_AUTO_SYNCH_BYTE)
+
+extern unsigned char breakDetected;
+extern unsigned char calStep;
+extern unsigned char defaultOSCCAL;
+#if defined(SYNCH_EDGE_PCINT)
+extern unsigned char synchEdgeLevel;
+#endif
+#if defined(SYNCH_TIMEOUT)
+extern unsigned char synchTimeout;
+extern unsigned char lastGoodOSCCAL;
+#endif
+#if defined(SYNCH_TRACE)
+extern unsigned char synchTrace[];
+extern unsigned char synchTraceHead;
+#endif
+#if defined(SYNCH_WAKE_STATS)
+extern unsigned char wakeCounting;
+extern unsigned int wakeTicks;
+extern unsigned int synchWakeToLock;
+#endif
+extern unsigned char synchState;
+
+#if defined(SYNCH_LOCK_RECORD)
+extern unsigned char synchLockEvent;
+extern unsigned char synchLockOSCCAL;
+extern signed int synchLockError;
+#endif
+
+#if defined(SYNCH_FILTER)
+unsigned int glitchCarry;
+#if (SYNCH_SAMPLES > 1)
+unsigned char samplesTaken;
+static unsigned int sampleSum;
+static unsigned int sampleMin;
+static unsigned int sampleMax;
+#endif
+#endif
+
+unsigned char synchHeaderBytes;     // SYNCH bytes in the last header, 1 or 2.
+// Result of the first SYNCH byte, and best value of the neighbor search.
+unsigned char headerOSCCAL;
+unsigned char bestOSCCAL;
+
+#if defined(SYNCH_TIMEOUT)
+SYNCH_ISR(SYNCH_TIMER_COMPARE_vect, SYNCH_TIMEOUT_ISR)
+{
+    WAKE_STATS_TICK();
+    if (--synchTimeout == 0)
+    {
+        if (calStep == 0)
+        {
+            // The first SYNCH byte is done, and no SYNCH edge has followed.
+            // The header had one SYNCH byte. The receiver is enabled.
+            FINISH_HEADER(headerOSCCAL, 1);
+            return;
+        }
+
+        // No SYNCH edge in time. Give up, and restore the result of the
+        // last successful synchronization.
+        breakDetected = FALSE;
+        OSCCAL = lastGoodOSCCAL;
+        NOP();
+
+        // Disable INT0 (external interrupt 0)
+        DIS_INT0();
+        SYNCH_TIMER_INT_MASK_REGISTER &= ~(1 << SYNCH_TIMER_COMPARE_IE);
+
+        // Enable UART receiver.
+        SYNCH_USART_STATCTRL_REG_B |= (1 << SYNCH_RXEN);
+    }
+}
+#endif
+
+// Force no optimization for this ISR.
+// If this is changed, the timing will not be correct. With avr-gcc, "make
+// report" fails if the read delay differs from COUNTER_READ_DELAY.
+#if defined(__IAR_SYSTEMS_ICC__)
+#pragma optimize=z 2
+#endif
+SYNCH_ISR(SYNCH_EDGE_vect, SYNCH_EXT_INT_ISR)
+{
+#if defined(NINE_BIT_TIMER)
+    unsigned int cycleCount;
+#else
+    unsigned char cycleCount;
+#endif
+#if defined(SYNCH_FILTER)
+    unsigned int sample;
+#endif
+    unsigned int countDiff;
+    static unsigned int bestCountDiff;
+    static unsigned char neighborsSearched;
+#if defined(SYNCH_LOCK_RECORD)
+    static signed int bestError;
+#endif
+
+#if defined(SYNCH_EDGE_PCINT)
+    // Ignore the edge that is not awaited, and changes of other pins. This
+    // runs before the timer is read, in the same time for either edge.
+    if (!EDGE_IS_WANTED())
+    {
+        return;
+    }
+#endif
+
+    READ_SYNCH_TIMER(cycleCount);
+
+    if (breakDetected)
+    {
+        RESTART_TIMEOUT();
+
+        FILTER_MEASUREMENT(cycleCount);
+        TRACE_STEP(cycleCount);
+
+        switch(synchState) {
+            case (SS_MEASURING):
+            {
+                //Set external interrupt 0 to trigger on rising edge.
+                SET_INT0_RISING();
+
+                if (calStep == 0)
+                {
+                    synchState = SS_NEIGHBOR_SEARCH;
+                }
+                else
+                {
+                    synchState = SS_BINARY_SEARCH;
+                }
+                return;
+                //break; //Not needed because of the return statement.
+            }
+
+            case (SS_BINARY_SEARCH):
+            {
+#if defined(SYNCH_LOCK_RECORD)
+                if (calStep == 1)
+                {
+                    // Last measurement. Store it before OSCCAL is adjusted.
+                    synchLockOSCCAL = OSCCAL;
+                    synchLockError = cycleCount - TARGET_COUNT;
+                }
+#endif
+                if ( cycleCount > COUNT_HIGH_LIMIT)
+                {
+                    OSCCAL -= calStep;
+                    NOP();
+                }
+                else if ( cycleCount < COUNT_LOW_LIMIT)
+                {
+                    OSCCAL += calStep;
+                    NOP();
+                }
+                else
+                {
+                    // Within limits, do nothing.
+                }
+                calStep >>= 1;   // Divide by 2.
+
+                if (calStep == 0)
+                {
+                    // First SYNCH byte done. Enable the UART receiver, which
+                    // tells at the next stop bit whether a second SYNCH byte
+                    // has been measured.
+                    headerOSCCAL = OSCCAL;
+                    bestOSCCAL = OSCCAL;
+                    bestCountDiff = 0xFFFF;
+                    neighborsSearched = 0;
+                    SYNCH_USART_STATCTRL_REG_B |= (1 << SYNCH_RXEN);
+                }
+                break;
+            }
+
+            case (SS_NEIGHBOR_SEARCH):
+            {
+                countDiff = ABS((signed int)cycleCount - TARGET_COUNT);
+                if (countDiff > AUTO_HEADER_LIMIT)
+                {
+                    // Not a SYNCH byte. Return to the result of the first
+                    // SYNCH byte while the character is received.
+                    OSCCAL = headerOSCCAL;
+                    NOP();
+                    bestOSCCAL = headerOSCCAL;
+                    DIS_INT0();
+                    return;
+                }
+                if (countDiff < bestCountDiff)
+                {
+                    bestCountDiff = countDiff;
+                    bestOSCCAL = OSCCAL;
+#if defined(SYNCH_LOCK_RECORD)
+                    bestError = cycleCount - TARGET_COUNT;
+#endif
+                }
+
+                if (++neighborsSearched == AUTO_NEIGHBOR_MEASUREMENTS)
+                {
+                    // Second SYNCH byte measured. Use the best value until
+                    // UART_RXC_ISR confirms it at the stop bit.
+                    OSCCAL = bestOSCCAL;
+                    NOP();
+#if defined(SYNCH_LOCK_RECORD)
+                    synchLockOSCCAL = bestOSCCAL;
+                    synchLockError = bestError;
+#endif
+                    DIS_INT0();
+                    return;
+                }
+
+                // Move towards the target, so that the best value is
+                // measured on each side of it.
+                if (cycleCount > TARGET_COUNT)
+                {
+                    OSCCAL--;
+                }
+                else
+                {
+                    OSCCAL++;
+                }
+                NOP();
+                break;
+            }
+        }
+        //Set external interrupt 0 to trigger on falling edge.
+        SET_INT0_FALLING();
+
+        synchState = SS_MEASURING;
+        return;
+    }
+    else  // breakDetected = FALSE
+    {
+        // Disable sleep flag. (Ensures that the device
+        // does not enter any sleep mode unintended.)
+        SLEEP_CTRL_REGISTER &= ~(1 << SE);
+        WAKE_STATS_START();
+        PREPARE_FOR_SYNCH();
+        return;
+    }
+}
+
+#endif
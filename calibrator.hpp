@@ -0,0 +1,612 @@
+/* This file has been prepared for Doxygen automatic documentation generation.*/
+/*! \file *********************************************************************
+ *
+ * \brief
+ *      Compile-time configured calibrator for C++.
+ *
+ *      Header-only alternative to the configuration macros in online_synch.h
+ *      and device_specific.h. The configuration is given as template
+ *      parameters, all derived values are computed at compile time, and an
+ *      invalid configuration is rejected with static_assert instead of
+ *      building code that silently misbehaves. All member functions are
+ *      static and inline, and follow the instruction order of the C
+ *      implementation; the generated code has not yet been compared with it
+ *      (size and cycles) with avr-g++. Several configurations can be
+ *      instantiated in one program.
+ *
+ *      Example, for an ATmega168 at 8 MHz synchronized at 19200 baud:
+ *      \code
+ *      typedef osccal::Calibrator<osccal::ATmega168, osccal::SingleSynchByte,
+ *                                 8000000UL, 19200UL, 9> Cal;
+ *
+ *      ISR(INT0_vect)      { Cal::onEdge(); }
+ *      ISR(USART_RX_vect)  { unsigned char c; if (Cal::onReceive(c)) PORTB = c; }
+ *      \endcode
+ *
+ *      Requires a C++11 compiler (avr-g++). The optional features of
+ *      online_synch.h (filtering, verification, timeouts, drift tracking)
+ *      are only available in the C implementation.
+ *
+ * \par Application note:
+ *      AVR054 Synchronization of the internal RC oscillator
+ *
+ * \par Documentation:
+ *      For comprehensive code documentation, supported compilers, compiler
+ *      settings and supported devices see readme.html
+ *
+ ******************************************************************************/
+
+#if !defined(_CALIBRATOR_HPP_)
+#define _CALIBRATOR_HPP_
+
+#include <stdint.h>
+#include <avr/io.h>
+
+namespace osccal {
+
+// ***********************************************************************
+// Synchronization methods
+// ***********************************************************************
+struct SingleSynchByte {};  //!< Tolerance window search from an EEPROM default.
+struct DoubleSynchByte {};  //!< Full binary search followed by neighbor search.
+
+// ***********************************************************************
+// Device traits
+//
+// Only the traits of the device selected with -mmcu are defined, as the
+// register names are those of the device header. Each trait provides the
+// registers and bits that differ between devices, the OSCCAL resolution and
+// the counter read delays. The read delays are those of COUNTER_READ_DELAY_8
+// and COUNTER_READ_DELAY_9 in device_specific.h, and must be changed with
+// them; "make report" compares them with the ISR of the "make cpp" builds.
+// ***********************************************************************
+
+#if defined(__AVR_ATtiny84__) | defined(__AVR_ATtiny85__)
+// No USART. The calibrator needs the UART frame error to detect a BREAK.
+struct ATtiny84_85
+{
+    static const bool hasUsart = false;
+};
+typedef ATtiny84_85 ATtiny84;
+typedef ATtiny84_85 ATtiny85;
+typedef ATtiny84_85 CurrentDevice;
+#endif
+
+#if defined(__AVR_ATtiny2313__)
+struct ATtiny2313
+{
+    static const bool hasUsart = true;
+    static const uint8_t oscCalResolution = 7;
+    static const uint8_t counterReadDelay8 = 3;
+    static const uint8_t counterReadDelay9 = 22;
+    static const uint8_t stabilizeNops = 1;
+    static const uint8_t pinInt0 = PD2;
+    static const uint8_t rxen = RXEN;
+    static const uint8_t rxcie = RXCIE;
+    static const uint8_t fe = FE;
+    static const uint8_t eepromWriteEnable = EEPE;
+    static const uint8_t sleepEnable = SE;
+
+    static volatile uint8_t& portInt0()       { return PORTD; }
+    static volatile uint8_t& ddrInt0()        { return DDRD; }
+    static volatile uint8_t& extIntMask()     { return GIMSK; }
+    static volatile uint8_t& extIntSense()    { return MCUCR; }
+    static volatile uint8_t& extIntFlag()     { return EIFR; }
+    static volatile uint8_t& timerPrescaler() { return TCCR0B; }
+    static volatile uint8_t& timerIntFlag()   { return TIFR; }
+    static volatile uint8_t& usartStatA()     { return UCSRA; }
+    static volatile uint8_t& usartStatB()     { return UCSRB; }
+    static volatile uint8_t& ubrrH()          { return UBRRH; }
+    static volatile uint8_t& ubrrL()          { return UBRRL; }
+    static volatile uint8_t& udr()            { return UDR; }
+    static volatile uint8_t& sleepControl()   { return MCUCR; }
+};
+typedef ATtiny2313 CurrentDevice;
+#endif
+
+#if defined(__AVR_ATmega8__) | defined(__AVR_ATmega16__) | \
+    defined(__AVR_ATmega32__)
+struct ATmega8_16_32
+{
+    static const bool hasUsart = true;
+    static const uint8_t oscCalResolution = 8;
+    static const uint8_t counterReadDelay8 = 3;
+    static const uint8_t counterReadDelay9 = 19;
+    static const uint8_t stabilizeNops = 1;
+    static const uint8_t pinInt0 = PD2;
+    static const uint8_t rxen = RXEN;
+    static const uint8_t rxcie = RXCIE;
+    static const uint8_t fe = FE;
+    static const uint8_t eepromWriteEnable = EEWE;
+    static const uint8_t sleepEnable = SE;
+
+    static volatile uint8_t& portInt0()       { return PORTD; }
+    static volatile uint8_t& ddrInt0()        { return DDRD; }
+    static volatile uint8_t& extIntMask()     { return GICR; }
+    static volatile uint8_t& extIntSense()    { return MCUCR; }
+    static volatile uint8_t& extIntFlag()     { return GIFR; }
+    static volatile uint8_t& timerPrescaler() { return TCCR0; }
+    static volatile uint8_t& timerIntFlag()   { return TIFR; }
+    static volatile uint8_t& usartStatA()     { return UCSRA; }
+    static volatile uint8_t& usartStatB()     { return UCSRB; }
+    static volatile uint8_t& ubrrH()          { return UBRRH; }
+    static volatile uint8_t& ubrrL()          { return UBRRL; }
+    static volatile uint8_t& udr()            { return UDR; }
+    static volatile uint8_t& sleepControl()   { return MCUCR; }
+};
+typedef ATmega8_16_32 ATmega8;
+typedef ATmega8_16_32 ATmega16;
+typedef ATmega8_16_32 ATmega32;
+typedef ATmega8_16_32 CurrentDevice;
+#endif
+
+#if defined(__AVR_ATmega48__) | defined(__AVR_ATmega88__) | \
+    defined(__AVR_ATmega168__)
+struct ATmega48_88_168
+{
+    static const bool hasUsart = true;
+    static const uint8_t oscCalResolution = 7;
+    static const uint8_t counterReadDelay8 = 3;
+    static const uint8_t counterReadDelay9 = 17;
+    static const uint8_t stabilizeNops = 1;
+    static const uint8_t pinInt0 = PD2;
+    static const uint8_t rxen = RXEN0;
+    static const uint8_t rxcie = RXCIE0;
+    static const uint8_t fe = FE0;
+    static const uint8_t eepromWriteEnable = EEPE;
+    static const uint8_t sleepEnable = SE;
+
+    static volatile uint8_t& portInt0()       { return PORTD; }
+    static volatile uint8_t& ddrInt0()        { return DDRD; }
+    static volatile uint8_t& extIntMask()     { return EIMSK; }
+    static volatile uint8_t& extIntSense()    { return EICRA; }
+    static volatile uint8_t& extIntFlag()     { return EIFR; }
+    static volatile uint8_t& timerPrescaler() { return TCCR0B; }
+    static volatile uint8_t& timerIntFlag()   { return TIFR0; }
+    static volatile uint8_t& usartStatA()     { return UCSR0A; }
+    static volatile uint8_t& usartStatB()     { return UCSR0B; }
+    static volatile uint8_t& ubrrH()          { return UBRR0H; }
+    static volatile uint8_t& ubrrL()          { return UBRR0L; }
+    static volatile uint8_t& udr()            { return UDR0; }
+    static volatile uint8_t& sleepControl()   { return SMCR; }
+};
+typedef ATmega48_88_168 ATmega48;
+typedef ATmega48_88_168 ATmega88;
+typedef ATmega48_88_168 ATmega168;
+typedef ATmega48_88_168 CurrentDevice;
+#endif
+
+#if defined(__AVR_ATmega169__)
+// Revision F and later (ATmega169P) have an 8-bit OSCCAL register. Use
+// ATmega169P for those.
+template <uint8_t Resolution>
+struct ATmega169Base
+{
+    static const bool hasUsart = true;
+    static const uint8_t oscCalResolution = Resolution;
+    static const uint8_t counterReadDelay8 = 3;
+    static const uint8_t counterReadDelay9 = 17;
+    static const uint8_t stabilizeNops = 1;
+    static const uint8_t pinInt0 = PD1;
+    static const uint8_t rxen = RXEN0;
+    static const uint8_t rxcie = RXCIE0;
+    static const uint8_t fe = FE0;
+    static const uint8_t eepromWriteEnable = EEWE;
+    static const uint8_t sleepEnable = SE;
+
+    static volatile uint8_t& portInt0()       { return PORTD; }
+    static volatile uint8_t& ddrInt0()        { return DDRD; }
+    static volatile uint8_t& extIntMask()     { return EIMSK; }
+    static volatile uint8_t& extIntSense()    { return EICRA; }
+    static volatile uint8_t& extIntFlag()     { return EIFR; }
+    static volatile uint8_t& timerPrescaler() { return TCCR0A; }
+    static volatile uint8_t& timerIntFlag()   { return TIFR0; }
+    static volatile uint8_t& usartStatA()     { return UCSR0A; }
+    static volatile uint8_t& usartStatB()     { return UCSR0B; }
+    static volatile uint8_t& ubrrH()          { return UBRR0H; }
+    static volatile uint8_t& ubrrL()          { return UBRR0L; }
+    static volatile uint8_t& udr()            { return UDR0; }
+    static volatile uint8_t& sleepControl()   { return SMCR; }
+};
+typedef ATmega169Base<7> ATmega169;
+typedef ATmega169Base<8> ATmega169P;
+typedef ATmega169 CurrentDevice;
+#endif
+
+#if defined(__AVR_ATmega64__) | defined(__AVR_ATmega128__)
+struct ATmega64_128
+{
+    static const bool hasUsart = true;
+    static const uint8_t oscCalResolution = 8;
+    static const uint8_t counterReadDelay8 = 3;
+    static const uint8_t counterReadDelay9 = 19;
+    static const uint8_t stabilizeNops = 8;  // See errata in data sheet.
+    static const uint8_t pinInt0 = PD0;
+    static const uint8_t rxen = RXEN0;
+    static const uint8_t rxcie = RXCIE0;
+    static const uint8_t fe = FE0;
+    static const uint8_t eepromWriteEnable = EEWE;
+    static const uint8_t sleepEnable = SE;
+
+    static volatile uint8_t& portInt0()       { return PORTD; }
+    static volatile uint8_t& ddrInt0()        { return DDRD; }
+    static volatile uint8_t& extIntMask()     { return EIMSK; }
+    static volatile uint8_t& extIntSense()    { return EICRA; }
+    static volatile uint8_t& extIntFlag()     { return EIFR; }
+    static volatile uint8_t& timerPrescaler() { return TCCR0; }
+    static volatile uint8_t& timerIntFlag()   { return TIFR; }
+    static volatile uint8_t& usartStatA()     { return UCSR0A; }
+    static volatile uint8_t& usartStatB()     { return UCSR0B; }
+    static volatile uint8_t& ubrrH()          { return UBRR0H; }
+    static volatile uint8_t& ubrrL()          { return UBRR0L; }
+    static volatile uint8_t& udr()            { return UDR0; }
+    static volatile uint8_t& sleepControl()   { return MCUCR; }
+};
+typedef ATmega64_128 ATmega64;
+typedef ATmega64_128 ATmega128;
+typedef ATmega64_128 CurrentDevice;
+#endif
+
+// ***********************************************************************
+// Helpers
+// ***********************************************************************
+
+// Counter type for the timer width.
+template <uint8_t TimerBits> struct CounterType;
+template <> struct CounterType<8> { typedef uint8_t Type; };
+template <> struct CounterType<9> { typedef uint16_t Type; };
+
+// Let the RC oscillator stabilize after a change in OSCCAL.
+template <uint8_t N>
+inline void stabilize()
+{
+    __asm__ __volatile__ ("nop");
+    stabilize<N - 1>();
+}
+template <>
+inline void stabilize<0>()
+{
+}
+
+// ***********************************************************************
+// Calibrator
+// ***********************************************************************
+
+/*! \brief Run-time calibration of the internal RC oscillator.
+ *
+ *  \param Device               Device traits, e.g. ATmega168.
+ *  \param Method               SingleSynchByte or DoubleSynchByte.
+ *  \param FCpu                 Target CPU frequency in Hz.
+ *  \param Baud                 Baud rate of the SYNCH signal.
+ *  \param TimerBits            8, or 9 to use the overflow flag as ninth bit.
+ *  \param AccuracyPermille     Tolerance of the single synch byte method.
+ *  \param DefaultOsccalAddress EEPROM address of the default OSCCAL value
+ *                              (single synch byte method).
+ *  \param DefaultOsccalMask    0x80 to use the upper OSCCAL range on devices
+ *                              with two ranges (double synch byte method).
+ */
+template <class Device, class Method, uint32_t FCpu, uint32_t Baud,
+          uint8_t TimerBits = 9, uint8_t AccuracyPermille = 10,
+          uint16_t DefaultOsccalAddress = 0, uint8_t DefaultOsccalMask = 0x00>
+class Calibrator
+{
+    static_assert(Device::hasUsart,
+                  "device has no USART; a BREAK cannot be detected");
+    static_assert((TimerBits == 8) || (TimerBits == 9),
+                  "TimerBits must be 8 or 9");
+
+public:
+    typedef typename CounterType<TimerBits>::Type Count;
+
+    //! Expected # of processor ticks between UART bit lengths.
+    static constexpr uint16_t bitCycles = FCpu / Baud;
+    static constexpr uint8_t counterReadDelay =
+        (TimerBits == 9) ? Device::counterReadDelay9 : Device::counterReadDelay8;
+    static constexpr uint16_t targetCount = bitCycles - counterReadDelay;
+    static constexpr uint16_t synchLimit = bitCycles * AccuracyPermille / 1000;
+    static constexpr uint16_t countLowLimit = targetCount - synchLimit;
+    static constexpr uint16_t countHighLimit = targetCount + synchLimit;
+    //! Baud rate register, rounded to the nearest value.
+    static constexpr uint16_t ubrr = (FCpu + 8 * Baud) / (16 * Baud) - 1;
+
+    static_assert(bitCycles > counterReadDelay,
+                  "Baud is too high for FCpu");
+    static_assert(targetCount <= ((TimerBits == 9) ? 511 : 255),
+                  "TARGET_COUNT is larger than the timer");
+    static_assert(ubrr <= 0x0FFF, "Baud is too low for the UART");
+    static_assert(synchLimit > 0,
+                  "AccuracyPermille is below one timer count");
+    static_assert(DefaultOsccalMask == 0x00 || DefaultOsccalMask == 0x80,
+                  "DefaultOsccalMask must be 0x00 or 0x80");
+
+    //! Set up the UART, the INT0 pin and the timer.
+    static void init()
+    {
+        Device::usartStatB() |= (1 << Device::rxen) | (1 << Device::rxcie);
+        Device::ubrrH() = (ubrr >> 8);
+        Device::ubrrL() = (ubrr & 0x00ff);
+
+        // Set INT0 pin as input, no internal pullup.
+        Device::ddrInt0() &= ~(1 << Device::pinInt0);
+        Device::portInt0() &= ~(1 << Device::pinInt0);
+
+        // If 8 bit timer is used, it must be started here.
+        if (TimerBits == 8)
+        {
+            Device::timerPrescaler() |= (1 << CS00);
+        }
+
+        readDefault(Method());
+    }
+
+    /*! \brief UART receive complete handler.
+     *
+     *  Call from the USART RX interrupt. A frame error starts a
+     *  synchronization.
+     *
+     *  \param data  Received character.
+     *  \return      true if data holds a received character.
+     */
+    static bool onReceive(uint8_t& data)
+    {
+        if (Device::usartStatA() & (1 << Device::fe))
+        {
+            prepareForSynch();
+            return false;
+        }
+        data = Device::udr();
+        return true;
+    }
+
+    /*! \brief INT0 handler.
+     *
+     *  Call from the INT0 interrupt. The timer is read first, so the code
+     *  before the call must not depend on the configuration.
+     */
+    static void onEdge()
+    {
+        Count cycleCount = readCounter();
+
+        if (breakDetected)
+        {
+            search(cycleCount, Method());
+        }
+        else
+        {
+            // Woken up by the low level of a BREAK. Disable sleep flag.
+            Device::sleepControl() &= ~(1 << Device::sleepEnable);
+            prepareForSynch();
+        }
+    }
+
+    //! true when a synchronization has completed, and no new one is in
+    //! progress.
+    static bool isLocked()
+    {
+        return *(volatile uint8_t*)&lockedOnce &&
+               !*(volatile uint8_t*)&breakDetected;
+    }
+
+private:
+    static const uint8_t measuring = 0;
+    static const uint8_t binarySearch = 1;
+    static const uint8_t neighborSearch = 2;
+
+    static const uint8_t defaultMidOsccal =
+        (1 << (Device::oscCalResolution - 1)) | DefaultOsccalMask;
+
+    static uint8_t breakDetected;
+    static uint8_t lockedOnce;      // Set by the first completed search.
+    static uint8_t synchState;
+    static uint8_t calStep;
+    static uint8_t defaultOsccal;
+
+    // Double synch byte method.
+    static uint8_t bestCountDiff;
+    static uint8_t bestOsccal;
+    static int8_t sign;
+    static uint8_t neighborsSearched;
+
+    static uint8_t initialStep(SingleSynchByte) { return 1 << 4; }
+    static uint8_t initialStep(DoubleSynchByte)
+    {
+        return 1 << (Device::oscCalResolution - 2);
+    }
+
+    static void readDefault(SingleSynchByte)
+    {
+        while (EECR & (1 << Device::eepromWriteEnable))
+        { // Wait if EEPROM is busy writing
+        }
+        EEAR = DefaultOsccalAddress;
+        EECR |= (1 << EERE);
+        defaultOsccal = EEDR;
+    }
+    static void readDefault(DoubleSynchByte)
+    {
+        defaultOsccal = defaultMidOsccal;
+    }
+
+    static void setRising()
+    {
+        Device::extIntSense() |= (1 << ISC01) | (1 << ISC00);
+        Device::extIntFlag() = (1 << INTF0);
+    }
+
+    static void setFalling()
+    {
+        Device::extIntSense() |= (1 << ISC01);
+        Device::extIntSense() &= ~(1 << ISC00);
+        Device::extIntFlag() = (1 << INTF0);
+    }
+
+    static void setOsccal(uint8_t value)
+    {
+        OSCCAL = value;
+        stabilize<Device::stabilizeNops>();
+    }
+
+    static void finish()
+    {
+        breakDetected = false;
+        lockedOnce = true;
+        // Enable UART receiver, disable INT0.
+        Device::usartStatB() |= (1 << Device::rxen) | (1 << Device::rxcie);
+        Device::extIntMask() &= ~(1 << INT0);
+    }
+
+    static void prepareForSynch()
+    {
+        breakDetected = true;
+        synchState = measuring;
+        calStep = initialStep(Method());
+        Device::usartStatB() &= ~(1 << Device::rxen);
+        setFalling();
+        Device::extIntFlag() |= (1 << INTF0);
+        Device::extIntMask() |= (1 << INT0);
+        setOsccal(defaultOsccal);
+    }
+
+    // Same instruction order as SYNCH_EXT_INT_ISR, which COUNTER_READ_DELAY
+    // is measured for.
+    static Count readCounter()
+    {
+        Count cycleCount;
+        if (TimerBits == 9)
+        {
+            // Stop Timer/Counter0.
+            Device::timerPrescaler() &= ~((1 << CS02) | (1 << CS01) | (1 << CS00));
+            cycleCount = TCNT0;
+            // Use the overflow flag as the high bit of a 9-bit timer.
+            cycleCount |= ((Device::timerIntFlag() & (1 << TOV0)) << (8 - TOV0));
+            TCNT0 = 0;
+            Device::timerIntFlag() = (1 << TOV0);
+            // Start Timer/Counter0.
+            Device::timerPrescaler() = (1 << CS00);
+        }
+        else
+        {
+            cycleCount = TCNT0;
+            TCNT0 = 0;
+        }
+        return cycleCount;
+    }
+
+    static void search(Count cycleCount, SingleSynchByte)
+    {
+        if (synchState == measuring)
+        {
+            setRising();
+            synchState = binarySearch;
+            return;
+        }
+
+        if (cycleCount > countHighLimit)
+        {
+            setOsccal(OSCCAL - calStep);
+        }
+        else if (cycleCount < countLowLimit)
+        {
+            setOsccal(OSCCAL + calStep);
+        }
+        calStep >>= 1;
+
+        if (calStep == 0)
+        {
+            finish();
+        }
+        else
+        {
+            setFalling();
+            synchState = measuring;
+        }
+    }
+
+    static void search(Count cycleCount, DoubleSynchByte)
+    {
+        uint8_t countDiff;
+
+        switch (synchState)
+        {
+            case measuring:
+                setRising();
+                synchState = (calStep == 0) ? neighborSearch : binarySearch;
+                return;
+
+            case binarySearch:
+                if (cycleCount > targetCount)
+                {
+                    sign = -1;
+                    setOsccal(OSCCAL - calStep);
+                }
+                else if (cycleCount < targetCount)
+                {
+                    sign = 1;
+                    setOsccal(OSCCAL + calStep);
+                }
+                calStep >>= 1;
+
+                if (calStep == 0)
+                {
+                    // Binary search complete, set up for neighbor search.
+                    // The last measurement was at the value before the
+                    // step, unless the count was on target.
+                    neighborsSearched = 0;
+                    bestCountDiff = absDiff(cycleCount);
+                    bestOsccal = OSCCAL;
+                    if (cycleCount != targetCount)
+                    {
+                        bestOsccal -= sign;
+                    }
+                }
+                break;
+
+            case neighborSearch:
+                countDiff = absDiff(cycleCount);
+                if (countDiff < bestCountDiff)
+                {
+                    bestCountDiff = countDiff;
+                    bestOsccal = OSCCAL;
+                }
+
+                if (++neighborsSearched == (10 - (Device::oscCalResolution - 1)))
+                {
+                    setOsccal(bestOsccal);
+                    finish();
+                    return;
+                }
+                setOsccal(OSCCAL + sign);
+                break;
+        }
+        setFalling();
+        synchState = measuring;
+    }
+
+    static uint8_t absDiff(Count cycleCount)
+    {
+        return (cycleCount > targetCount) ? (cycleCount - targetCount)
+                                          : (targetCount - cycleCount);
+    }
+};
+
+// Static data members.
+#define OSCCAL_CALIBRATOR_MEMBER(type, name) \
+template <class D, class M, uint32_t F, uint32_t B, uint8_t T, uint8_t A, \
+          uint16_t E, uint8_t K> \
+type Calibrator<D, M, F, B, T, A, E, K>::name
+
+OSCCAL_CALIBRATOR_MEMBER(uint8_t, breakDetected);
+OSCCAL_CALIBRATOR_MEMBER(uint8_t, lockedOnce);
+OSCCAL_CALIBRATOR_MEMBER(uint8_t, synchState);
+OSCCAL_CALIBRATOR_MEMBER(uint8_t, calStep);
+OSCCAL_CALIBRATOR_MEMBER(uint8_t, defaultOsccal);
+OSCCAL_CALIBRATOR_MEMBER(uint8_t, bestCountDiff);
+OSCCAL_CALIBRATOR_MEMBER(uint8_t, bestOsccal);
+OSCCAL_CALIBRATOR_MEMBER(int8_t, sign);
+OSCCAL_CALIBRATOR_MEMBER(uint8_t, neighborsSearched);
+
+#undef OSCCAL_CALIBRATOR_MEMBER
+
+} // namespace osccal
+
+#endif
@@ -0,0 +1,75 @@
+/* This file has been prepared for Doxygen automatic documentation generation.*/
+/*! \file *********************************************************************
+ *
+ * \brief
+ *      Compiler abstraction.
+ *
+ *      The source code is written for IAR EWAVR. This file maps the IAR
+ *      intrinsic functions and interrupt declarations to avr-gcc/avr-libc,
+ *      so the same source code can be built with both compilers.
+ *
+ *      Interrupt service routines are declared with SYNCH_ISR(vector, name).
+ *      With avr-gcc the function is named after the vector, as with ISR() in
+ *      avr-libc, and the name is only used by IAR. tools/report_info.c maps
+ *      the names to the vectors for the build report.
+ *
+ *      With SYNCH_HOST defined, the source code is built for the host, with
+ *      the registers in memory (see tools/replay/host_io.h). The interrupt
+ *      service routines are then plain functions, called by the replay
+ *      harness.
+ *
+ * \par Application note:
+ *      AVR054 Synchronization of the internal RC oscillator
+ *
+ * \par Documentation:
+ *      For comprehensive code documentation, supported compilers, compiler
+ *      settings and supported devices see readme.html
+ *
+ ******************************************************************************/
+
+#if !defined(_COMPILER_H_)
+#define _COMPILER_H_
+
+#if defined(SYNCH_HOST)
+
+#include "tools/replay/host_io.h"
+
+#define __no_operation()
+#define __enable_interrupt()
+#define __disable_interrupt()
+#define __sleep()
+#define __delay_cycles(n)
+
+#define SYNCH_ISR(vect, name) \
+void name(void)
+
+#elif defined(__GNUC__)
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+#define __no_operation()       __asm__ __volatile__ ("nop")
+#define __enable_interrupt()   sei()
+#define __disable_interrupt()  cli()
+#define __sleep()              sleep_cpu()
+#define __delay_cycles(n)      __builtin_avr_delay_cycles(n)
+
+#define SYNCH_ISR(vect, name) \
+void vect(void) __attribute__((signal, used, externally_visible)); \
+void vect(void)
+
+#else // IAR
+
+#include <ioavr.h>
+#include <inavr.h>
+
+#define SYNCH_PRAGMA(x)        _Pragma(#x)
+
+#define SYNCH_ISR(vect, name) \
+SYNCH_PRAGMA(vector=vect) \
+__interrupt void name(void)
+
+#endif
+
+#endif
@@ -0,0 +1,57 @@
+/* This file has been prepared for Doxygen automatic documentation generation.*/
+/*! \file *********************************************************************
+ *
+ * \brief
+ *      Example use of the C++ calibrator.
+ *
+ *      Equivalent of main.c together with single_synch_byte.c, using the
+ *      compile-time configured calibrator in calibrator.hpp. Build with
+ *      avr-g++ -std=c++11 for one of the devices supported there.
+ *
+ * \par Application note:
+ *      AVR054 Synchronization of the internal RC oscillator
+ *
+ ******************************************************************************/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "../calibrator.hpp"
+
+#if !defined(F_CPU)
+#define F_CPU 8000000UL
+#endif
+
+// Same configuration as the defaults in online_synch.h.
+typedef osccal::Calibrator<osccal::CurrentDevice, osccal::SingleSynchByte,
+                           F_CPU, 19200UL, 9> Cal;
+
+#if defined(USART_RX_vect)
+ISR(USART_RX_vect)
+#elif defined(USART0_RX_vect)
+ISR(USART0_RX_vect)
+#else
+ISR(USART_RXC_vect)
+#endif
+{
+    uint8_t data;
+    if (Cal::onReceive(data))
+    {
+        // Process character received by UART receiver.
+        PORTB = data;
+    }
+}
+
+ISR(INT0_vect)
+{
+    Cal::onEdge();
+}
+
+int main(void)
+{
+    Cal::init();
+
+    sei();
+    for (;;)
+    {
+    }
+}
@@ -11,7 +11,8 @@
  *      For this file to function properly, a symbol describing the targeted
  *      device must be defined at compilation time. In IAR Embedded Workbench
  *      this is done automatically by selecting a device in "Processor
- *      configuration" in the "Project/Options" menu.
+ *      configuration" in the "Project/Options" menu. avr-gcc defines the
+ *      __AVR_<device>__ symbols from the -mmcu option.
  *
  * \par Application note:
  *      AVR054 Synchronization of the internal RC oscillator
@@ -48,6 +49,23 @@
 
 #define SYNCH_TIMER_PRESCALER_REGISTER     TCCR0B
 #define SYNCH_TIMER_INT_FLAG_REGISTER      TIFR
+#define SYNCH_TIMER_COMPARE_REGISTER       OCR0A
+#define SYNCH_TIMER_COMPARE_IE             OCIE0A
+#define SYNCH_TIMER_COMPARE_FLAG           OCF0A
+#define SYNCH_TIMER_COMPARE_vect           TIM0_COMPA_vect
+#if defined(__AVR_ATtiny84__)
+#define SYNCH_TIMER_INT_MASK_REGISTER      TIMSK0
+#else
+#define SYNCH_TIMER_INT_MASK_REGISTER      TIMSK
+#endif
+
+// ADC bandgap channel with VCC as reference, for SUPPLY_TRACKING.
+#if defined(__AVR_ATtiny84__)
+#define SUPPLY_ADMUX                       0x21
+#else
+#define SUPPLY_ADMUX                       0x0C
+#endif
+#define BANDGAP_MILLIVOLTS                 1100
 
 #define SYNCH_USART_RXC_vect               //USART0_RX_vect
 #define SYNCH_USART_STATCTRL_REG_A         //UCSRA
@@ -58,26 +76,34 @@
 #define SYNCH_RXCIE                        //RXCIE
 #define SYNCH_UDR                          //UDR
 #define SYNCH_FE                           //FE
+#define SYNCH_U2X                          //U2X
+#define SYNCH_TXEN                         //TXEN
+#define SYNCH_UDRE                         //UDRE
+#define SYNCH_TXC                          //TXC
+#define SYNCH_MPCM                         //MPCM
 
 #define EEPROM_WRITE_ENABLE                EEPE
 
+#define SLEEP_CTRL_REGISTER                MCUCR
+#define SLEEP_MODE_MASK                    ((1 << SM1) | (1 << SM0))
+#define SLEEP_MODE_IDLE                    0
+#define SLEEP_MODE_POWER_DOWN              (1 << SM1)
+
 #define SET_OC1A_DIRECTION()  //(DDRB |= (1 << PB3))
 
 #define OSCCAL_RESOLUTION                  7
 
-#if defined(NINE_BIT_TIMER)
-#define COUNTER_READ_DELAY    //22
-#else
-#define COUNTER_READ_DELAY    //3
-#endif
+#define COUNTER_READ_DELAY_9               //22
+#define COUNTER_READ_DELAY_8               //3
 
 #endif
 
-#if defined(__AT90Tiny2313__) | defined(__ATtiny2313__)
+#if defined(__AT90Tiny2313__) | defined(__ATtiny2313__) | \
+    defined(__AVR_ATtiny2313__)
 
 #define PORT_INT0                          PORTD
 #define DDR_INT0                           DDRD
-#define PIN_NUMBER_INT0                    PORTD0
+#define PIN_NUMBER_INT0                    PORTD2
 #define EXT_INT_MASK_REGISTER              GIMSK
 #define EXT_INT_SENSE_CTRL_REGISTER        MCUCR
 #define EXT_INT_FLAG_REGISTER              EIFR
@@ -85,8 +111,21 @@
 
 #define SYNCH_TIMER_PRESCALER_REGISTER     TCCR0B
 #define SYNCH_TIMER_INT_FLAG_REGISTER      TIFR
+#define SYNCH_TIMER_INT_MASK_REGISTER      TIMSK
+#define SYNCH_TIMER_COMPARE_REGISTER       OCR0A
+#define SYNCH_TIMER_COMPARE_IE             OCIE0A
+#define SYNCH_TIMER_COMPARE_FLAG           OCF0A
+#define SYNCH_TIMER_COMPARE_vect           TIMER0_COMPA_vect
+
+#define REFERENCE_TIMER_INT_MASK_REGISTER  TIMSK
+#define REFERENCE_TIMER_INT_FLAG_REGISTER  TIFR
+#define REFERENCE_TIMER_OVF_vect           TIMER1_OVF_vect
 
+#if defined(__GNUC__)
+#define SYNCH_USART_RXC_vect               USART_RX_vect
+#else
 #define SYNCH_USART_RXC_vect               USART0_RX_vect
+#endif
 #define SYNCH_USART_STATCTRL_REG_A         UCSRA
 #define SYNCH_USART_STATCTRL_REG_B         UCSRB
 #define SYNCH_UBRRH                        UBRRH
@@ -95,25 +134,34 @@
 #define SYNCH_RXCIE                        RXCIE
 #define SYNCH_UDR                          UDR
 #define SYNCH_FE                           FE
+#define SYNCH_U2X                          U2X
+#define SYNCH_TXEN                         TXEN
+#define SYNCH_UDRE                         UDRE
+#define SYNCH_TXC                          TXC
+#define SYNCH_MPCM                         MPCM
 
 #define EEPROM_WRITE_ENABLE                EEPE
 
+#define SLEEP_CTRL_REGISTER                MCUCR
+#define SLEEP_MODE_MASK                    ((1 << SM1) | (1 << SM0))
+#define SLEEP_MODE_IDLE                    0
+#define SLEEP_MODE_POWER_DOWN              (1 << SM0)
+
 #define SET_OC1A_DIRECTION()  (DDRB |= (1 << PB3))
 
 #define OSCCAL_RESOLUTION                  7
 
-#if defined(NINE_BIT_TIMER)
-#define COUNTER_READ_DELAY    22
-#else
-#define COUNTER_READ_DELAY    3
-#endif
+#define COUNTER_READ_DELAY_9               22
+#define COUNTER_READ_DELAY_8               3
 
 #endif
 
 
 #if defined(__AT90Mega8__) | defined(__ATmega8__) | \
     defined(__AT90Mega16__) | defined(__ATmega16__) | \
-    defined(__AT90Mega32__) | defined(__ATmega32__)
+    defined(__AT90Mega32__) | defined(__ATmega32__) | \
+    defined(__AVR_ATmega8__) | defined(__AVR_ATmega16__) | \
+    defined(__AVR_ATmega32__)
 
 #define PORT_INT0                          PORTD
 #define DDR_INT0                           DDRD
@@ -125,6 +173,30 @@
 
 #define SYNCH_TIMER_PRESCALER_REGISTER     TCCR0
 #define SYNCH_TIMER_INT_FLAG_REGISTER      TIFR
+// Timer/Counter0 on ATmega8 has no compare unit.
+#if defined(__AT90Mega16__) | defined(__ATmega16__) | \
+    defined(__AT90Mega32__) | defined(__ATmega32__) | \
+    defined(__AVR_ATmega16__) | defined(__AVR_ATmega32__)
+#define SYNCH_TIMER_INT_MASK_REGISTER      TIMSK
+#define SYNCH_TIMER_COMPARE_REGISTER       OCR0
+#define SYNCH_TIMER_COMPARE_IE             OCIE0
+#define SYNCH_TIMER_COMPARE_FLAG           OCF0
+#define SYNCH_TIMER_COMPARE_vect           TIMER0_COMP_vect
+#endif
+
+#define REFERENCE_TIMER_INT_MASK_REGISTER  TIMSK
+#define REFERENCE_TIMER_INT_FLAG_REGISTER  TIFR
+#define REFERENCE_TIMER_OVF_vect           TIMER1_OVF_vect
+
+// ADC bandgap channel with AVCC as reference, for SUPPLY_TRACKING. On the
+// ATmega16/32, MUX4..0 = 01110 is a differential channel.
+#if defined(__AT90Mega8__) | defined(__ATmega8__) | defined(__AVR_ATmega8__)
+#define SUPPLY_ADMUX                       ((1 << REFS0) | 0x0E)
+#define BANDGAP_MILLIVOLTS                 1300
+#else
+#define SUPPLY_ADMUX                       ((1 << REFS0) | 0x1E)
+#define BANDGAP_MILLIVOLTS                 1220
+#endif
 
 #define SYNCH_USART_RXC_vect               USART_RXC_vect
 #define SYNCH_USART_STATCTRL_REG_A         UCSRA
@@ -135,11 +207,22 @@
 #define SYNCH_RXCIE                        RXCIE
 #define SYNCH_UDR                          UDR
 #define SYNCH_FE                           FE
+#define SYNCH_U2X                          U2X
+#define SYNCH_TXEN                         TXEN
+#define SYNCH_UDRE                         UDRE
+#define SYNCH_TXC                          TXC
+#define SYNCH_MPCM                         MPCM
 
 #define EEPROM_WRITE_ENABLE                EEWE
 
+#define SLEEP_CTRL_REGISTER                MCUCR
+#define SLEEP_MODE_MASK                    ((1 << SM2) | (1 << SM1) | (1 << SM0))
+#define SLEEP_MODE_IDLE                    0
+#define SLEEP_MODE_POWER_DOWN              (1 << SM1)
+
 #if defined(__AT90Mega16__) | defined(__ATmega16__) | \
-    defined(__AT90Mega32__) | defined(__ATmega32__)
+    defined(__AT90Mega32__) | defined(__ATmega32__) | \
+    defined(__AVR_ATmega16__) | defined(__AVR_ATmega32__)
 #define SET_OC1A_DIRECTION()  (DDRD |= (1 << PD5))
 #else
 #define SET_OC1A_DIRECTION()  (DDRB |= (1 << PB1))
@@ -147,18 +230,17 @@
 
 #define OSCCAL_RESOLUTION                  8
 
-#if defined(NINE_BIT_TIMER)
-#define COUNTER_READ_DELAY    19
-#else
-#define COUNTER_READ_DELAY    3
-#endif
+#define COUNTER_READ_DELAY_9               19
+#define COUNTER_READ_DELAY_8               3
 
 #endif
 
 
 #if defined(__AT90Mega48__) | defined(__ATmega48__) | \
     defined(__AT90Mega88__) | defined(__ATmega88__) | \
-    defined(__AT90Mega168__) | defined(__ATmega168__)
+    defined(__AT90Mega168__) | defined(__ATmega168__) | \
+    defined(__AVR_ATmega48__) | defined(__AVR_ATmega88__) | \
+    defined(__AVR_ATmega168__) | defined(__AVR_ATmega328P__)
 
 #define PORT_INT0                          PORTD
 #define DDR_INT0                           DDRD
@@ -170,6 +252,38 @@
 
 #define SYNCH_TIMER_PRESCALER_REGISTER     TCCR0B
 #define SYNCH_TIMER_INT_FLAG_REGISTER      TIFR0
+#define SYNCH_TIMER_INT_MASK_REGISTER      TIMSK0
+#define SYNCH_TIMER_COMPARE_REGISTER       OCR0A
+#define SYNCH_TIMER_COMPARE_IE             OCIE0A
+#define SYNCH_TIMER_COMPARE_FLAG           OCF0A
+#define SYNCH_TIMER_COMPARE_vect           TIMER0_COMPA_vect
+
+#define REFERENCE_TIMER_INT_MASK_REGISTER  TIMSK1
+#define REFERENCE_TIMER_INT_FLAG_REGISTER  TIFR1
+#define REFERENCE_TIMER_OVF_vect           TIMER1_OVF_vect
+// Asynchronous Timer/Counter2 for a 32.768 kHz crystal on TOSC1/TOSC2.
+#define REFERENCE_CRYSTAL_CONTROL_REGISTER TCCR2B
+#define REFERENCE_CRYSTAL_INT_MASK_REGISTER TIMSK2
+#define REFERENCE_CRYSTAL_INT_FLAG_REGISTER TIFR2
+#define REFERENCE_CRYSTAL_vect             TIMER2_OVF_vect
+#define REFERENCE_CRYSTAL_BUSY_MASK        ((1 << TCN2UB) | (1 << OCR2AUB) | \
+                                            (1 << OCR2BUB) | (1 << TCR2AUB) | \
+                                            (1 << TCR2BUB))
+
+// ADC bandgap channel with AVCC as reference, for SUPPLY_TRACKING.
+#define SUPPLY_ADMUX                       ((1 << REFS0) | 0x0E)
+#define BANDGAP_MILLIVOLTS                 1100
+
+// Pin change interrupt on RXD, for SYNCH_EDGE_PCINT.
+#define PIN_RXD                            PIND
+#define PIN_NUMBER_RXD                     0
+#define PCINT_MASK_REGISTER                PCMSK2
+#define PCINT_RXD                          PCINT16
+#define PCINT_CTRL_REGISTER                PCICR
+#define PCINT_FLAG_REGISTER                PCIFR
+#define PCINT_ENABLE                       PCIE2
+#define PCINT_FLAG                         PCIF2
+#define SYNCH_PCINT_vect                   PCINT2_vect
 
 #define SYNCH_USART_RXC_vect               USART_RX_vect
 #define SYNCH_USART_STATCTRL_REG_A         UCSR0A
@@ -180,23 +294,31 @@
 #define SYNCH_RXCIE                        RXCIE0
 #define SYNCH_UDR                          UDR0
 #define SYNCH_FE                           FE0
+#define SYNCH_U2X                          U2X0
+#define SYNCH_TXEN                         TXEN0
+#define SYNCH_UDRE                         UDRE0
+#define SYNCH_TXC                          TXC0
+#define SYNCH_MPCM                         MPCM0
 
 #define OSCCAL_RESOLUTION                  7
 
 #define EEPROM_WRITE_ENABLE                EEPE
 
+#define SLEEP_CTRL_REGISTER                SMCR
+#define SLEEP_MODE_MASK                    ((1 << SM2) | (1 << SM1) | (1 << SM0))
+#define SLEEP_MODE_IDLE                    0
+#define SLEEP_MODE_POWER_DOWN              (1 << SM1)
+
 #define SET_OC1A_DIRECTION()  (DDRB |= (1 << PB1))
 
-#if defined(NINE_BIT_TIMER)
-#define COUNTER_READ_DELAY    17
-#else
-#define COUNTER_READ_DELAY    3
-#endif
+#define COUNTER_READ_DELAY_9               17
+#define COUNTER_READ_DELAY_8               3
 
 #endif
 
 
-#if defined(__AT90Mega169__) | defined(__ATmega169__)
+#if defined(__AT90Mega169__) | defined(__ATmega169__) | \
+    defined(__AVR_ATmega169__)
 /* Make sure to change the line commented futher down when using ATmega169P to
 * fit the new oscillator version, as the OSCCAL register is 8 bit, instead of 7
 * in ATmega169 revision A to E.*/
@@ -211,7 +333,43 @@
 
 #define SYNCH_TIMER_PRESCALER_REGISTER     TCCR0A
 #define SYNCH_TIMER_INT_FLAG_REGISTER      TIFR0
+#define SYNCH_TIMER_INT_MASK_REGISTER      TIMSK0
+#define SYNCH_TIMER_COMPARE_REGISTER       OCR0A
+#define SYNCH_TIMER_COMPARE_IE             OCIE0A
+#define SYNCH_TIMER_COMPARE_FLAG           OCF0A
+#define SYNCH_TIMER_COMPARE_vect           TIMER0_COMP_vect
+
+#define REFERENCE_TIMER_INT_MASK_REGISTER  TIMSK1
+#define REFERENCE_TIMER_INT_FLAG_REGISTER  TIFR1
+#define REFERENCE_TIMER_OVF_vect           TIMER1_OVF_vect
+// Asynchronous Timer/Counter2 for a 32.768 kHz crystal on TOSC1/TOSC2.
+#define REFERENCE_CRYSTAL_CONTROL_REGISTER TCCR2A
+#define REFERENCE_CRYSTAL_INT_MASK_REGISTER TIMSK2
+#define REFERENCE_CRYSTAL_INT_FLAG_REGISTER TIFR2
+#define REFERENCE_CRYSTAL_vect             TIMER2_OVF_vect
+#define REFERENCE_CRYSTAL_BUSY_MASK        ((1 << TCN2UB) | (1 << OCR2UB) | \
+                                            (1 << TCR2UB))
+
+// ADC bandgap channel with AVCC as reference, for SUPPLY_TRACKING.
+#define SUPPLY_ADMUX                       ((1 << REFS0) | 0x1E)
+#define BANDGAP_MILLIVOLTS                 1100
+
+// Pin change interrupt on RXD, for SYNCH_EDGE_PCINT.
+#define PIN_RXD                            PINE
+#define PIN_NUMBER_RXD                     0
+#define PCINT_MASK_REGISTER                PCMSK0
+#define PCINT_RXD                          PCINT0
+#define PCINT_CTRL_REGISTER                EIMSK
+#define PCINT_FLAG_REGISTER                EIFR
+#define PCINT_ENABLE                       PCIE0
+#define PCINT_FLAG                         PCIF0
+#define SYNCH_PCINT_vect                   PCINT0_vect
+
+#if defined(__GNUC__)
+#define SYNCH_USART_RXC_vect               USART0_RX_vect
+#else
 #define SYNCH_USART_RXC_vect               USART0_RXC_vect
+#endif
 #define SYNCH_USART_STATCTRL_REG_A         UCSR0A
 #define SYNCH_USART_STATCTRL_REG_B         UCSR0B
 #define SYNCH_UBRRH                        UBRR0H
@@ -220,6 +378,11 @@
 #define SYNCH_RXCIE                        RXCIE0
 #define SYNCH_UDR                          UDR0
 #define SYNCH_FE                           FE0
+#define SYNCH_U2X                          U2X0
+#define SYNCH_TXEN                         TXEN0
+#define SYNCH_UDRE                         UDRE0
+#define SYNCH_TXC                          TXC0
+#define SYNCH_MPCM                         MPCM0
 
 /* When using ATmega169 revision F and on, change the OSCCAL resolution due
 to different OSCCAL registers*/
@@ -228,19 +391,22 @@ to different OSCCAL registers*/
 
 #define EEPROM_WRITE_ENABLE                EEWE
 
+#define SLEEP_CTRL_REGISTER                SMCR
+#define SLEEP_MODE_MASK                    ((1 << SM2) | (1 << SM1) | (1 << SM0))
+#define SLEEP_MODE_IDLE                    0
+#define SLEEP_MODE_POWER_DOWN              (1 << SM1)
+
 #define SET_OC1A_DIRECTION()  (DDRB |= (1 << PB5))
 
-#if defined(NINE_BIT_TIMER)
-#define COUNTER_READ_DELAY    17
-#else
-#define COUNTER_READ_DELAY    3
-#endif
+#define COUNTER_READ_DELAY_9               17
+#define COUNTER_READ_DELAY_8               3
 
 #endif
 
 
 #if defined(__AT90Mega64__) | defined(__ATmega64__) | \
-    defined(__AT90Mega128__) | defined(__ATmega128__)
+    defined(__AT90Mega128__) | defined(__ATmega128__) | \
+    defined(__AVR_ATmega64__) | defined(__AVR_ATmega128__)
 
 #define PORT_INT0                          PORTD
 #define DDR_INT0                           DDRD
@@ -252,8 +418,25 @@ to different OSCCAL registers*/
 
 #define SYNCH_TIMER_PRESCALER_REGISTER     TCCR0
 #define SYNCH_TIMER_INT_FLAG_REGISTER      TIFR
+#define SYNCH_TIMER_INT_MASK_REGISTER      TIMSK
+#define SYNCH_TIMER_COMPARE_REGISTER       OCR0
+#define SYNCH_TIMER_COMPARE_IE             OCIE0
+#define SYNCH_TIMER_COMPARE_FLAG           OCF0
+#define SYNCH_TIMER_COMPARE_vect           TIMER0_COMP_vect
+
+#define REFERENCE_TIMER_INT_MASK_REGISTER  TIMSK
+#define REFERENCE_TIMER_INT_FLAG_REGISTER  TIFR
+#define REFERENCE_TIMER_OVF_vect           TIMER1_OVF_vect
+
+// ADC bandgap channel with AVCC as reference, for SUPPLY_TRACKING.
+#define SUPPLY_ADMUX                       ((1 << REFS0) | 0x1E)
+#define BANDGAP_MILLIVOLTS                 1230
 
+#if defined(__GNUC__)
+#define SYNCH_USART_RXC_vect               USART0_RX_vect
+#else
 #define SYNCH_USART_RXC_vect               USART0_RXC_vect
+#endif
 #define SYNCH_USART_STATCTRL_REG_A         UCSR0A
 #define SYNCH_USART_STATCTRL_REG_B         UCSR0B
 #define SYNCH_UBRRH                        UBRR0H
@@ -262,19 +445,34 @@ to different OSCCAL registers*/
 #define SYNCH_RXCIE                        RXCIE0
 #define SYNCH_UDR                          UDR0
 #define SYNCH_FE                           FE0
+#define SYNCH_U2X                          U2X0
+#define SYNCH_TXEN                         TXEN0
+#define SYNCH_UDRE                         UDRE0
+#define SYNCH_TXC                          TXC0
+#define SYNCH_MPCM                         MPCM0
 
 #define OSCCAL_RESOLUTION                  8
 
 #define EEPROM_WRITE_ENABLE                EEWE
 
+#define SLEEP_CTRL_REGISTER                MCUCR
+#define SLEEP_MODE_MASK                    ((1 << SM2) | (1 << SM1) | (1 << SM0))
+#define SLEEP_MODE_IDLE                    0
+#define SLEEP_MODE_POWER_DOWN              (1 << SM1)
+
 #define SET_OC1A_DIRECTION()  (DDRB |= (1 << PB5))
 
-#if defined(NINE_BIT_TIMER)
-#define COUNTER_READ_DELAY    19
-#else
-#define COUNTER_READ_DELAY    3
+#define COUNTER_READ_DELAY_9               19
+#define COUNTER_READ_DELAY_8               3
+
 #endif
 
+// Timer/Counter0 read delay of SYNCH_EXT_INT_ISR, per device above for the
+// 9-bit and the 8-bit timer. calibrator.hpp uses both.
+#if defined(NINE_BIT_TIMER)
+#define COUNTER_READ_DELAY    COUNTER_READ_DELAY_9
+#else
+#define COUNTER_READ_DELAY    COUNTER_READ_DELAY_8
 #endif
 
 #endif
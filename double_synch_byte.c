@@ -6,9 +6,7 @@
  *
  *      This file contain the implementation of the double SYNCH byte
  *      synchronization method. The UART RXC interrupt service routine (ISR) is
- *      a part of this implementation. To implement a communication protocol,
- *      code to handle reception of UART data must be added in this file or
- *      single_synch_byte.c depending on which method is used.
+ *      shared with the other SYNCH byte methods, see synch_uart.c.
  *
  * \par Application note:
  *      AVR054 Synchronization of the internal RC oscillator
@@ -29,58 +27,108 @@
 
 #include "online_synch.h"
 #include "device_specific.h"
-#include <ioavr.h>
-#include <inavr.h>
+#include "compiler.h"
 
 #if defined(SYNCH_METHOD_DOUBLE_SYNCH_BYTE)
 
 extern unsigned char breakDetected;
 extern unsigned char calStep;
+#if defined(SYNCH_EDGE_PCINT)
+extern unsigned char synchEdgeLevel;
+#endif
+#if defined(SYNCH_TIMEOUT)
+extern unsigned char synchTimeout;
+extern unsigned char lastGoodOSCCAL;
+#endif
+#if defined(SYNCH_TRACE)
+extern unsigned char synchTrace[];
+extern unsigned char synchTraceHead;
+#endif
+#if defined(SYNCH_WAKE_STATS)
+extern unsigned char wakeCounting;
+extern unsigned int wakeTicks;
+extern unsigned int synchWakeToLock;
+#endif
 extern unsigned char synchState;
 
-void Initialize_Synchronization(void)
-{
-    // Initialize UART.
-    SYNCH_USART_STATCTRL_REG_B |= (1 << SYNCH_RXEN) | (1 << SYNCH_RXCIE);
-    SYNCH_UBRRH = (SYNCH_UBRR >> 8); //Set baud rate registers
-    SYNCH_UBRRL = (SYNCH_UBRR & 0x00ff);
-
-    // Set INT0 pin as input, no internal pullup.
-    DDR_INT0 &= ~(1 << PIN_NUMBER_INT0);
-    PORT_INT0 &= ~(1 << PIN_NUMBER_INT0);
-
-    // If 8 bit timer is used, it must be started here.
-    #if ! defined(NINE_BIT_TIMER)
-    SYNCH_TIMER_PRESCALER_REGISTER |= (1 << CS00); // Timer/Counter1 runs at fclk. (no prescaling)
-    #endif
-}
-
+#if defined(SYNCH_LOCK_RECORD)
+extern unsigned char synchLockEvent;
+extern unsigned char synchLockOSCCAL;
+extern signed int synchLockError;
+#endif
+#if defined(DRIFT_TRACKING)
+extern unsigned int synchCharCount;
+#endif
+#if defined(SYNCH_FILTER)
+unsigned int glitchCarry;
+#if (SYNCH_SAMPLES > 1)
+unsigned char samplesTaken;
+static unsigned int sampleSum;
+static unsigned int sampleMin;
+static unsigned int sampleMax;
+#endif
+#endif
+#if defined(SYNCH_DITHER)
+// OSCCAL values below and above the target, and the share of time at the
+// upper value, ditherNum / ditherDen. ditherDen is 0 when there is no pair.
+// One OSCCAL step is a few counts, so the counts fit in a byte.
+static unsigned char ditherLowOSCCAL;
+static unsigned char ditherHighOSCCAL;
+static unsigned char ditherNum;
+unsigned char ditherDen;   // Also cleared by UART_RXC_ISR.
+static unsigned char ditherAcc;
+#endif
 
-#pragma vector=SYNCH_USART_RXC_vect
-__interrupt void UART_RXC_ISR(void)
+#if defined(SYNCH_TIMEOUT) | defined(SYNCH_DITHER)
+SYNCH_ISR(SYNCH_TIMER_COMPARE_vect, SYNCH_TIMEOUT_ISR)
 {
-    unsigned char temp;
-    if (SYNCH_USART_STATCTRL_REG_A & (1 << SYNCH_FE))  // Frame error has occured.
+#if defined(SYNCH_DITHER)
+    if (!breakDetected)
     {
-        PREPARE_FOR_SYNCH();
+        // Select the OSCCAL value for the next 256 cycles. The accumulator
+        // spreads the upper values evenly, ditherNum in every ditherDen.
+        ditherAcc += ditherNum;
+        if (ditherAcc >= ditherDen)
+        {
+            ditherAcc -= ditherDen;
+            OSCCAL = ditherHighOSCCAL;
+        }
+        else
+        {
+            OSCCAL = ditherLowOSCCAL;
+        }
+        NOP();
+        return;
     }
-    else
+#endif
+#if defined(SYNCH_TIMEOUT)
+    WAKE_STATS_TICK();
+    if (--synchTimeout == 0)
     {
-        // Process character received by UART receiver.
-        // It is necessary that the UART data register is read at this point
-        // to clear the receive buffer. If the value read is not used, the
-        // compiler will optimize away the reading of UART data register. In
-        // this case the synchronization will not work.
-        temp = SYNCH_UDR;
-        PORTB = temp;
+        // No SYNCH edge in time. Give up, and restore the result of the
+        // last successful synchronization.
+        breakDetected = FALSE;
+        OSCCAL = lastGoodOSCCAL;
+        NOP();
+
+        // Disable INT0 (external interrupt 0)
+        DIS_INT0();
+        SYNCH_TIMER_INT_MASK_REGISTER &= ~(1 << SYNCH_TIMER_COMPARE_IE);
+
+        // Enable UART receiver.
+        SYNCH_USART_STATCTRL_REG_B |= (1 << SYNCH_RXEN);
     }
+#endif
 }
+#endif
 
 // Force no optimization for this ISR.
-// If this is changed, the timing will not be correct.
+// If this is changed, the timing will not be correct. With avr-gcc, "make
+// report" fails if the read delay differs from COUNTER_READ_DELAY.
+#if defined(__IAR_SYSTEMS_ICC__)
 #pragma optimize=z 2
-#pragma vector=SYNCH_EXT_INT_vect
-__interrupt void SYNCH_EXT_INT_ISR(void)
+#endif
+SYNCH_ISR(SYNCH_EDGE_vect, SYNCH_EXT_INT_ISR)
 {
     unsigned char countDiff;
     static unsigned char bestCountDiff;
@@ -93,32 +141,45 @@ __interrupt void SYNCH_EXT_INT_ISR(void)
 #else
     unsigned char cycleCount;
 #endif
-
+#if defined(SYNCH_FILTER)
+    unsigned int sample;
+#endif
+#if defined(SYNCH_DITHER) | defined(SYNCH_INTERPOLATE)
+    // Previous measurement of the search, and its OSCCAL value.
 #if defined(NINE_BIT_TIMER)
-    // Stop Timer/Counter0.
-    SYNCH_TIMER_PRESCALER_REGISTER &= ~((1 << CS02) | (1 << CS01) | (1 << CS00));
-
-    // Read Timer/Counter0.
-    cycleCount = TCNT0; // Retrieve the low 8 bits.
-	// Use the overflow flag as the high bit of a 9-bit timer.
-    cycleCount |= ((SYNCH_TIMER_INT_FLAG_REGISTER & (1 << TOV0)) << (8 - TOV0));
-
-    // Reset Timer/Counter0.
-    TCNT0 = 0;
-    SYNCH_TIMER_INT_FLAG_REGISTER = (1 << TOV0);   // Clear overflow flag.
-
-    // Start Timer/Counter0.
-    SYNCH_TIMER_PRESCALER_REGISTER = (1 << CS00);   // Timer/Counter1 runs at fclk. (no prescaling)
+    static unsigned int prevCount;
 #else
-    // Read Timer/Counter0.
-    cycleCount = TCNT0;
+    static unsigned char prevCount;
+#endif
+#endif
+#if defined(SYNCH_DITHER)
+    static unsigned char prevOSCCAL;
+#endif
+#if defined(SYNCH_INTERPOLATE)
+    unsigned int num;
+    unsigned int den;
+    unsigned char bit;
+    unsigned char offset;
+#endif
 
-    // Reset Timer/Counter0.
-    TCNT0 = 0;
+#if defined(SYNCH_EDGE_PCINT)
+    // Ignore the edge that is not awaited, and changes of other pins. This
+    // runs before the timer is read, in the same time for either edge.
+    if (!EDGE_IS_WANTED())
+    {
+        return;
+    }
 #endif
 
+    READ_SYNCH_TIMER(cycleCount);
+
     if (breakDetected)
     {
+        RESTART_TIMEOUT();
+
+        FILTER_MEASUREMENT(cycleCount);
+        TRACE_STEP(cycleCount);
+
         switch(synchState) {
             case (SS_MEASURING):
             {
@@ -139,6 +200,60 @@ __interrupt void SYNCH_EXT_INT_ISR(void)
 
             case (SS_BINARY_SEARCH):
             {
+#if defined(SYNCH_INTERPOLATE)
+                if (calStep == INTERPOLATE_STEP)
+                {
+                    // Third measurement, INTERPOLATE_WIDTH steps from the
+                    // previous one. Move to where the line through the two
+                    // gives TARGET_COUNT: |error| * INTERPOLATE_WIDTH / |slope|
+                    // steps towards the target. The division is done by
+                    // shift and subtract, rounded, and saturates at
+                    // INTERPOLATE_WIDTH - 1.
+                    num = ABS((signed int)cycleCount - TARGET_COUNT) *
+                          INTERPOLATE_WIDTH;
+                    den = ABS((signed int)cycleCount - (signed int)prevCount);
+                    num += den >> 1;
+                    den *= (INTERPOLATE_WIDTH >> 1);
+                    offset = 0;
+                    for (bit = (INTERPOLATE_WIDTH >> 1); bit != 0; bit >>= 1)
+                    {
+                        if (num >= den)
+                        {
+                            num -= den;
+                            offset |= bit;
+                        }
+                        den >>= 1;
+                    }
+
+                    // The measured value is the first candidate.
+                    neighborsSearched = 0;
+                    bestCountDiff = ABS((signed int)cycleCount - TARGET_COUNT);
+                    bestOSCCAL = OSCCAL;
+#if defined(SYNCH_LOCK_RECORD)
+                    synchLockError = cycleCount - TARGET_COUNT;
+#endif
+                    prevCount = cycleCount;
+#if defined(SYNCH_DITHER)
+                    prevOSCCAL = OSCCAL;
+#endif
+
+                    if (cycleCount > TARGET_COUNT)
+                    {
+                        OSCCAL -= offset;
+                    }
+                    else
+                    {
+                        OSCCAL += offset;
+                    }
+                    NOP();
+                    calStep = 0;
+                    break;
+                }
+                prevCount = cycleCount;
+#if defined(SYNCH_DITHER)
+                prevOSCCAL = OSCCAL;
+#endif
+#endif
                 if (cycleCount > TARGET_COUNT)
                 {
                     sign = -1;
@@ -160,38 +275,96 @@ __interrupt void SYNCH_EXT_INT_ISR(void)
                 if (calStep == 0)
                 {
                     // Binary search complete, set up for neighbor search
+                    // The last measurement was at the value before the
+                    // step, unless the count was on target.
                     neighborsSearched = 0;
-                    bestCountDiff = ABS(cycleCount - TARGET_COUNT);
-                    bestOSCCAL = OSCCAL - sign;
+                    bestCountDiff = ABS((signed int)cycleCount - TARGET_COUNT);
+                    bestOSCCAL = OSCCAL;
+                    if (cycleCount != TARGET_COUNT)
+                    {
+                        bestOSCCAL -= sign;
+                    }
+#if defined(SYNCH_LOCK_RECORD)
+                    synchLockError = cycleCount - TARGET_COUNT;
+#endif
+#if defined(SYNCH_DITHER)
+                    prevCount = cycleCount;
+                    prevOSCCAL = bestOSCCAL;
+#endif
                 }
                 break;
             }
 
             case (SS_NEIGHBOR_SEARCH):
             {
-                countDiff = ABS(cycleCount - TARGET_COUNT);
+                countDiff = ABS((signed int)cycleCount - TARGET_COUNT);
                 if (countDiff < bestCountDiff)
                 {
                     bestCountDiff = countDiff;
                     bestOSCCAL = OSCCAL;
+#if defined(SYNCH_LOCK_RECORD)
+                    synchLockError = cycleCount - TARGET_COUNT;
+#endif
+                }
+
+#if defined(SYNCH_DITHER)
+                // Remember the last pair of neighbors on each side of the
+                // target, and the share of time at the upper value that
+                // gives TARGET_COUNT on average.
+                if ((OSCCAL != (unsigned char)(prevOSCCAL + 1)) &
+                    (OSCCAL != (unsigned char)(prevOSCCAL - 1)))
+                {
+                    // Not neighbors.
+                }
+                else if ((cycleCount <= TARGET_COUNT) & (prevCount > TARGET_COUNT))
+                {
+                    ditherLowOSCCAL = OSCCAL;
+                    ditherHighOSCCAL = prevOSCCAL;
+                    ditherNum = TARGET_COUNT - cycleCount;
+                    ditherDen = prevCount - cycleCount;
+                }
+                else if ((cycleCount > TARGET_COUNT) & (prevCount <= TARGET_COUNT))
+                {
+                    ditherLowOSCCAL = prevOSCCAL;
+                    ditherHighOSCCAL = OSCCAL;
+                    ditherNum = TARGET_COUNT - prevCount;
+                    ditherDen = cycleCount - prevCount;
                 }
+#endif
+#if defined(SYNCH_DITHER) | defined(SYNCH_INTERPOLATE)
+                prevCount = cycleCount;
+#endif
+#if defined(SYNCH_DITHER)
+                prevOSCCAL = OSCCAL;
+#endif
+#if defined(SYNCH_INTERPOLATE)
+                // Confirm with the neighbor on the other side of the target.
+                sign = (cycleCount > TARGET_COUNT) ? -1 : 1;
+#endif
 
                 neighborsSearched++;
 
                 // Are there any calibration cycles left?
-                if (neighborsSearched == (10 - (OSCCAL_RESOLUTION - 1)))
+                if (neighborsSearched == NEIGHBOR_MEASUREMENTS)
                 {
                     // No calibration cycles left, clean up and finish.
 
                     OSCCAL = bestOSCCAL;
                     NOP();
                     breakDetected = FALSE;
+#if defined(SYNCH_LOCK_RECORD)
+                    synchLockOSCCAL = bestOSCCAL;
+                    synchLockEvent = LOCK_EVENT_ALL;
+#endif
 
                     // Enable UART receiver.
                     SYNCH_USART_STATCTRL_REG_B |= (1 << SYNCH_RXEN) | (1 << SYNCH_RXCIE);
 
                     // Disable INT0 (external interrupt 0)
                     DIS_INT0();
+                    STOP_TIMEOUT();
+                    RELEASE_HOST_TIMER();
+                    START_DITHER();
                     return;
                 }
                 else
@@ -212,7 +385,8 @@ __interrupt void SYNCH_EXT_INT_ISR(void)
     {
         // Disable sleep flag. (Ensures that the device
         // does not enter any sleep mode unintended.)
-        MCUCR &= ~(1 << SE);
+        SLEEP_CTRL_REGISTER &= ~(1 << SE);
+        WAKE_STATS_START();
         PREPARE_FOR_SYNCH();
         return;
     }
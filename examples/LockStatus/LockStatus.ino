@@ -0,0 +1,61 @@
+// Calibrates the internal oscillator from the BREAK/SYNCH headers of a bus
+// master while the sketch keeps sampling a sensor.
+//
+// Connect the master TX line to both RXD and INT0 of the slave. The board
+// must run from the internal 8 MHz oscillator. The baud rate, method and
+// options are set in online_synch.h of the library.
+
+#include <ATtinyOSCCAL.h>
+
+const int ledPin = 13;
+const int sensorPin = A0;
+
+unsigned long lastSample;
+unsigned int sensorValue;
+long residual;
+
+void locked(unsigned char osccal)
+{
+    // Called from ATtinyOSCCAL.update() after each synchronization.
+    digitalWrite(ledPin, HIGH);
+}
+
+void setup()
+{
+    pinMode(ledPin, OUTPUT);
+    ATtinyOSCCAL.onLock(locked);
+    if (!ATtinyOSCCAL.begin(19200))
+    {
+        // The baud rate does not match SYNCH_FREQUENCY in online_synch.h.
+        for (;;)
+        {
+        }
+    }
+}
+
+void loop()
+{
+    ATtinyOSCCAL.update();
+
+    // Not blocked by a synchronization in progress. millis() does not
+    // advance during one, which takes a few milliseconds.
+    if (millis() - lastSample >= 100)
+    {
+        lastSample = millis();
+        sensorValue = analogRead(sensorPin);
+    }
+
+    if (ATtinyOSCCAL.state() == ATTINYOSCCAL_CALIBRATING)
+    {
+        digitalWrite(ledPin, LOW);
+    }
+
+    while (ATtinyOSCCAL.available())
+    {
+        // Application command from the master.
+        if (ATtinyOSCCAL.read() == 'R')
+        {
+            residual = ATtinyOSCCAL.residualPPM();
+        }
+    }
+}
@@ -9,8 +9,8 @@
  *      could be used in a protocol implementation to save power while there
  *      is no activity on the bus. It takes care of all the necessary steps to
  *      make the device enter one of the sleep modes and still be prepared to
- *      receive a BREAK signal. By default it will enter "Idle" mode. To enter
- *      a different sleep mode change the SMn bits that are set in MCUCR.
+ *      receive a BREAK signal. By default it will enter "Idle" mode. Define
+ *      SYNCH_SLEEP_POWER_DOWN in online_synch.h to enter "Power-down" mode.
  *
  * \par Application note:
  *      AVR054 Synchronization of the internal RC oscillator
@@ -30,19 +30,36 @@
  ******************************************************************************/
 
 
-#include <inavr.h>
-#include <ioavr.h>
+#include "compiler.h"
 #include "online_synch.h"
 
 
 unsigned char breakDetected;
 unsigned char synchState;
 unsigned char calStep;
+#if defined(SYNCH_EDGE_PCINT)
+unsigned char synchEdgeLevel;   // Level of RXD after the awaited edge.
+#endif
+#if defined(SYNCH_TIMEOUT)
+unsigned char synchTimeout;
+unsigned char lastGoodOSCCAL;
+#endif
+#if defined(SYNCH_WAKE_STATS)
+unsigned char wakeCounting;
+unsigned int wakeTicks;
+unsigned int synchWakeToLock;   // Timeout ticks from wake-up to lock.
+#endif
 
+#if !defined(SYNCH_METHOD_REFERENCE)
 void sleep(void);
+#endif
 
+// The Arduino core has its own main(). The library calls
+// Initialize_Synchronization() from ATtinyOSCCAL::begin().
+#if !defined(ARDUINO)
 void main(void)
 {
+#if !defined(SYNCH_METHOD_REFERENCE)
     // For testing only:
     // Set up Timer/counter1 to generate a frequency of fclk/2 on OC2
     SET_OC1A_DIRECTION();
@@ -50,6 +67,7 @@ void main(void)
     OCR1A = 0x00;
     TCCR1A = (1 << COM1A0);
     TCCR1B = (1 << WGM12) | (1 << CS10);
+#endif
 
 
     Initialize_Synchronization();
@@ -57,26 +75,51 @@ void main(void)
     __enable_interrupt();
     for(;;)
     {
+#if defined(DRIFT_TRACKING)
+        Synch_Update_Drift();
+#endif
+#if defined(RESYNCH_REPORT)
+        Synch_Report_Resynch();
+#endif
+#if defined(SUPPLY_TRACKING)
+        Synch_Update_Supply();
+#endif
+#if defined(SYNCH_TRACE)
+        Synch_Trace_Send();
+#endif
     }
 }
+#endif
 
+#if !defined(SYNCH_METHOD_REFERENCE)
 void sleep(void)
 {
     __disable_interrupt();
+
+    // Do not sleep while a synchronization is in progress.
+    if (breakDetected)
+    {
+        __enable_interrupt();
+        return;
+    }
+
     SET_INT0_LOW(); // Set INT0 to trigger on low level.
     EN_INT0();      // Enable INT0 (external interrupt 0)
 
-    #if defined(SM2)
-    // Set sleep  mode.
-    MCUCR |= ((1 << SE) | (1 << SM0) | (0 << SM0) | (0 << SM2));
-    #else
-    MCUCR |= ((1 << SE) | (1 << SM0) | (0 << SM0));
-    #endif
+    // Set sleep mode. INT0 on low level is the only external interrupt that
+    // can wake the device from all sleep modes. The level must be held until
+    // the oscillator has started, which the BREAK does (see
+    // SLEEP_WAKEUP_CYCLES).
+    SLEEP_CTRL_REGISTER = (SLEEP_CTRL_REGISTER & ~SLEEP_MODE_MASK) |
+                          SYNCH_SLEEP_MODE | (1 << SE);
 
-    // Make sure that interrupts are enabled, and go to sleep.
+    // Make sure that interrupts are enabled, and go to sleep. The instruction
+    // following __enable_interrupt() is always executed before any pending
+    // interrupt, so a BREAK can not be missed between the two.
     __enable_interrupt();
     __sleep();
 }
+#endif
 
 /*! \mainpage
 * \section Intro Introduction
@@ -85,23 +128,29 @@ void sleep(void)
 * internal oscillator run-time via the uart. 50% duty cycle is needed.
 *
 * \section SCI Compilator Info
-* This software was compiled with IAR Embedded Workbench 4.12A. For other
-* compilers than IAR modifications are needed.
+* This software was compiled with IAR Embedded Workbench 4.12A. It also builds
+* with avr-gcc and avr-libc. compiler.h maps the IAR intrinsic functions and
+* interrupt declarations to avr-gcc.
 *
 * \section QSG Quick Start Guide
 * \subsection SCSC Synchronization source code
 * The "syncronization" directory contains the synchronization source code.
 * To make a project with IAR EWAVR:\n
 * - Create a project in a workspace and add the .c files to the project (main.c,
-* single_synch_byte.c and double_synch_byte.c).
+* single_synch_byte.c, double_synch_byte.c, auto_synch_byte.c, synch_uart.c and
+* synch_status.c).
 * - Select the relevant device, e.g. --cpu=tiny2313, ATtiny2313, enable bit
 * definitions in I/O include files, output format: ubrof8 for Debug and
 * intel_extended for Release.
 * - Select calibration method by uncommenting one of the SYNCH_METHOD_XXXXXX lines.
-* - Change TARGET_FREQUENCY to the frequency you want to calibrate the AVR towards.
+* - Change NOMINAL_FREQUENCY to the frequency you want to calibrate the AVR towards.
 * - Change SYNCH_FREQUENCY to the frequency of the master SYNCH signal.
 * - Change SYNCH_UBRR to the UART Baud Rate Register (UBRR) value needed for the
-* UART to communicate at SYNCH_FREQUENCY.
+* UART to communicate at SYNCH_FREQUENCY, or remove it to have the nearest value
+* calculated.
+* - For 57600 baud and above, define BAUD_EXACT. The AVR is then calibrated to
+* TARGET_FREQUENCY, the frequency near NOMINAL_FREQUENCY at which SYNCH_UBRR
+* gives exactly SYNCH_FREQUENCY, for example 7.3728 MHz at 115200 baud.
 * - If single SYNCH byte synchronization is selected in step 1, change the accuracy
 * in frequency needed after synchronization. 10 equals +/-1% of TARGET_FREQUENCY.
 * - If single SYNCH byte synchronization is selected, change DEFAULT_OSCCAL_ADDRESS
@@ -113,11 +162,117 @@ void sleep(void)
 * - If a device with two frequency ranges is used, it must be decided which one
 * is used. (Refer to the data sheet of the device for more information.)
 * Uncomment one of the lines defining DEFAULT_OSCCAL_MASK to select range.
+* - Optionally uncomment DRIFT_TRACKING to estimate the drift rate at every
+* lock. Synch_Time_To_Resynch() then returns the number of characters that can
+* be received before a resynchronization is due, and can be reported to the
+* master.
+* - On battery supplies, optionally uncomment SUPPLY_TRACKING to measure VCC
+* with the ADC bandgap channel and adjust OSCCAL between synchronizations as
+* the supply voltage changes. The OSCCAL change per volt is learned from locks
+* at different voltages. Call Synch_Update_Supply() from the main loop, and
+* set SUPPLY_INTERVAL to the number of calls between measurements.
+* - Optionally uncomment SYNCH_VERIFY to verify the final OSCCAL value with one
+* more SYNCH byte (single SYNCH byte method) and to read the residual error in
+* ppm from Synch_Residual_PPM(). The master must then send at least two SYNCH
+* bytes for the single SYNCH byte method, and two more per retry.
+* - On noisy buses, uncomment SYNCH_FILTER to reject glitches on INT0, and set
+* SYNCH_SAMPLES to filter several measurements per search step. The master must
+* then send SYNCH_SAMPLES times as many SYNCH bytes.
+* - Uncomment SYNCH_TIMEOUT to abort a synchronization when a SYNCH frame is
+* truncated. The last good OSCCAL value is restored and the UART receiver is
+* enabled again after SYNCH_EDGE_TIMEOUT bit times without a SYNCH edge.
+* - On devices with a pin change interrupt on RXD (ATmega48/88/168/328P and
+* ATmega169), uncomment SYNCH_EDGE_PCINT to take the SYNCH edges from RXD
+* instead of INT0, so that the INT0 pin is free. The edge the search waits for
+* is decoded from the level of RXD at the start of SYNCH_EXT_INT_ISR, in the
+* same number of cycles for both edges.
+* - To save power between frames, call sleep() when the bus is idle. Uncomment
+* SYNCH_SLEEP_POWER_DOWN for Power-down instead of Idle mode, and set
+* SLEEP_WAKEUP_CYCLES to the start-up time of the oscillator. With
+* SYNCH_WAKE_STATS, Synch_Wake_To_Lock() returns the time from wake-up to lock.
+* - With the double SYNCH byte method, uncomment SYNCH_INTERPOLATE to replace
+* the last binary search steps and the neighbor search by an interpolation
+* and two confirmation measurements. The master then sends one SYNCH byte.
+* - With the double SYNCH byte method, uncomment SYNCH_DITHER to alternate
+* OSCCAL between the two values on each side of TARGET_FREQUENCY after lock.
+* The mean frequency is then set to a fraction of one OSCCAL step, limited by
+* the resolution of one timer count at the two values. The compare match
+* interrupt runs every 256 cycles while locked.
+* - To let the master choose per header, select SYNCH_METHOD_AUTO_SYNCH_BYTE.
+* A header with one SYNCH byte gives the result of the single SYNCH byte
+* method, and one with two SYNCH bytes refines it with a neighbor search on the
+* second, for example after power-up. The number of SYNCH bytes in the last
+* header is in synchHeaderBytes. The first data byte after a one-byte header
+* must not be 0x55, and SYNCH_TIMEOUT should be used so that a one-byte header
+* completes on an idle bus.
+* - To diagnose bad locks, uncomment SYNCH_TRACE. Each measurement of the last
+* synchronizations is recorded in a ring of SYNCH_TRACE_SIZE entries, and the
+* ring is sent on the UART by Synch_Trace_Send() in the main loop when
+* SYNCH_TRACE_COMMAND is received. tools/trace_dump.py decodes it.
+* - Without a UART master, select SYNCH_METHOD_REFERENCE and add
+* reference_synch.c instead of the SYNCH byte files. OSCCAL is then calibrated
+* against a 32.768 kHz crystal on Timer/Counter2 (REFERENCE_CRYSTAL) or a
+* periodic signal on INT0 such as 1PPS (REFERENCE_FREQUENCY), counting the CPU
+* clock with Timer/Counter1 over REFERENCE_GATE reference periods. Call
+* Reference_Calibrate() to calibrate again. Timer/Counter1 is then not used for
+* the test output below, and sleep() is not built.
 *
 * The other files do not need to be changed. A brief description is given in
 * each file to help understand how an application can be integrated with the
 * synchronization source code.
 *
+* \subsection gccbld avr-gcc Build
+* The Makefile builds every device supported by avr-gcc with both methods and
+* with 8-bit and 9-bit timer, into the "build" directory. The method and timer
+* are selected on the command line with SYNCH_METHOD_XXXXXX and
+* SYNCH_TIMER_BITS. "make report" lists flash and SRAM usage, the worst-case
+* cycle counts of SYNCH_EXT_INT_ISR and UART_RXC_ISR, and the number of cycles
+* Timer/Counter0 is stopped in SYNCH_EXT_INT_ISR. The last must match
+* COUNTER_READ_DELAY in device_specific.h, as the IAR values do not apply to
+* code generated by avr-gcc; the report marks a build where it does not with
+* '!' and fails.
+*
+* "make sim" runs the builds under simavr against a simulated master that
+* sends the frames of the test code (see below), with the internal oscillator
+* off by each of the errors in SIM_ERRORS. tools/sim_slave.c prints the lock
+* time, the clock error at lock and whether the data byte was received, and
+* fails if a build does not lock within its accuracy. The harness has not been
+* run against simavr yet.
+*
+* Captured bus traces (VCD, or CSV exported from sigrok/PulseView) can be
+* replayed through SYNCH_EXT_INT_ISR and UART_RXC_ISR on the host with the
+* harness in tools/replay, which prints the OSCCAL trajectory and the received
+* bytes. "make replay" replays the traces in tools/replay/traces and compares
+* the result with the recorded output. Add captures from real buses there,
+* named after the method they are replayed with, together with the output of
+* the replay as the .expected file.
+*
+* "make bussim" runs tools/replay/bussim.c, which simulates one master and
+* hundreds of slaves on the same bus with the same slave model, each with its
+* own oscillator error, drift and OSCCAL step. It reports the payload
+* throughput, the share of the bus time spent on BREAK/SYNCH headers, the
+* error rates and the resynchronization counts, with a header in every frame,
+* in every K-th frame, or adaptively as with ADAPTIVE_RESYNCH in the test
+* code. Build the slaves with DRIFT_TRACKING for the adaptive policy.
+*
+* \subsection cppcd C++ Calibrator
+* calibrator.hpp is a header-only alternative to online_synch.h and
+* device_specific.h for avr-g++ (C++11). The configuration is given as template
+* parameters of osccal::Calibrator, and invalid configurations are rejected at
+* compile time. The "cpp_example" directory shows how the interrupt service
+* routines are set up.
+*
+* \subsection ardlib Arduino Library
+* The repository root is also an Arduino library (library.properties). The
+* Arduino IDE builds the synchronization source code with ARDUINO defined, which
+* leaves out main() and passes the received characters to the library instead
+* of PORTB. ATtinyOSCCAL.h provides begin(), a non-blocking state() and
+* isLocked(), an onLock() callback called from update() in loop(), and the
+* OSCCAL value and residual error. The method and options are selected in
+* online_synch.h as above. The library shares Timer/Counter0 with millis(), so
+* the options that use its compare interrupt are not available. See
+* examples/LockStatus.
+*
 * \subsection tstcd Test Code
 * The "test" directory contains contains source code that generates a
 * BREAK/SYNCH signal for testing. It can be run on a second AVR to act as a
@@ -133,16 +288,17 @@ void sleep(void)
 * - In "test.c", change the value of NUM_SYNCH_BYTES to generate different
 * synchronization sequences. NUM_SYNCH_BYTES should be 1 for the single SYNCH
 * byte synchronization method and 2 for the double synchronization byte method.
+* The auto SYNCH byte method accepts 1 or 2.
 *
 * \subsection PTGT Putting it together
 * To test the synchronization, program one AVR with the master test software.
 * Program a different AVR with the synchronization software. Make sure that the
 * fuses of the slave device are configured for internal RC operation at the
 * target speed. Connect the TXD pin on the master to RXD and INT0 pins on the
-* slave. The main function of the synchronization code sets up Timer1 to output
-* a waveform on the OC1A pin equal to half the speed of the internal RC
-* oscillator. The frequency of this signal can be measured to verify that the
-* synchronization works.
+* slave, or only to RXD with SYNCH_EDGE_PCINT. The main function of the
+* synchronization code sets up Timer1 to output a waveform on the OC1A pin
+* equal to half the speed of the internal RC oscillator. The frequency of this
+* signal can be measured to verify that the synchronization works.
 *
 *
 * \section CSZ Code Size
@@ -29,30 +29,253 @@
 // ***********************************************************************
 
 // Synchronization method. Uncomment one of the following to choose
-// Synchronization method.
+// Synchronization method. The method can also be defined on the command
+// line, as done by the build matrix in the Makefile.
+#if !defined(SYNCH_METHOD_SINGLE_SYNCH_BYTE) & \
+    !defined(SYNCH_METHOD_DOUBLE_SYNCH_BYTE) & \
+    !defined(SYNCH_METHOD_AUTO_SYNCH_BYTE) & \
+    !defined(SYNCH_METHOD_REFERENCE)
 #define SYNCH_METHOD_SINGLE_SYNCH_BYTE
 //#define SYNCH_METHOD_DOUBLE_SYNCH_BYTE
+//#define SYNCH_METHOD_AUTO_SYNCH_BYTE
+//#define SYNCH_METHOD_REFERENCE
+#endif
 
-#define TARGET_FREQUENCY      8000000         // CPU frequency
+#define NOMINAL_FREQUENCY     8000000         // CPU frequency
+// The baud rate can be defined on the command line. The 8-bit timer builds in
+// the Makefile use 38400 baud, as 19200 baud does not fit in 8 bits at 8 MHz.
+// If SYNCH_UBRR is not defined, the nearest setting is calculated.
+#if !defined(SYNCH_FREQUENCY)
 #define SYNCH_FREQUENCY       19200           // UART baud rate
 #define SYNCH_UBRR            25              // Baud rate register setting to
                                               // obtain SYNCH_FREQUENCY.
+#endif
+
+// SYNCH_DOUBLE_SPEED: set the U2X bit of the UART, which divides the clock by
+// 8 instead of 16 per bit.
+//#define SYNCH_DOUBLE_SPEED
+
+// BAUD_EXACT: calibrate to the frequency at which SYNCH_UBRR gives exactly
+// SYNCH_FREQUENCY, instead of to NOMINAL_FREQUENCY. At 8 MHz, 115200 baud
+// with SYNCH_UBRR 3 calibrates to 7.3728 MHz. This removes the rounding
+// error of the baud rate register, so that 57600 and 115200 baud can be used.
+// All timing is derived from TARGET_FREQUENCY, the calibrated frequency.
+//#define BAUD_EXACT
 #define SYNCH_ACCURACY        10              // 10 equals +/-1% (Only
-                                              // for single synch byte method)
+                                              // for single and auto synch
+                                              // byte methods)
 
 // DEFAULT_OSCCAL_ADDRESS: The location in EEPROM where the default OSCCAL
-// value can be found. (Only needed for single synch byte method).
+// value can be found. (Only needed for single and auto synch byte methods).
 #define DEFAULT_OSCCAL_ADDRESS  0x00
 
 // NINE_BIT_TIMER: utilize the overflow bit of Timer/Counter0 as the
-// ninth bit. Comment out to use only 8 bits.
+// ninth bit. Comment out to use only 8 bits. Defining SYNCH_TIMER_BITS as 8 on
+// the command line also selects 8 bits.
+#if !defined(SYNCH_TIMER_BITS) | (SYNCH_TIMER_BITS == 9)
 #define NINE_BIT_TIMER
+#endif
 
 // Only for devices with OSCCAL registers with two frequency ranges. Always use
 // 0x00 for devices with one continous OSCCAL register.
 #define DEFAULT_OSCCAL_MASK   0x00  // Use lower half
 //#define DEFAULT_OSCCAL_MASK   0x80  // Use upper half
 
+// DRIFT_TRACKING: record the converged OSCCAL value and the residual count
+// error at every lock, and estimate from consecutive locks how long the
+// clock stays within tolerance. See Synch_Update_Drift(). Uncomment to use.
+//#define DRIFT_TRACKING
+
+// RESYNCH_REPORT: with DRIFT_TRACKING, answer the query byte RESYNCH_QUERY +
+// SYNCH_NODE_ID from the master with the characters left until a
+// resynchronization is due. See Synch_Report_Resynch() and ADAPTIVE_RESYNCH
+// in test_node/test.c. Uncomment to use.
+//#define RESYNCH_REPORT
+#define SYNCH_NODE_ID         0               // 0 to 15, one per node.
+#define RESYNCH_QUERY         0xE0            // Query for node 0.
+#define RESYNCH_REPORT_MAX    0x3FFE          // Reported as two 7-bit bytes.
+#define RESYNCH_REPORT_UNKNOWN 0x3FFF         // No drift measured yet.
+
+// SYNCH_VERIFY: with the single synch byte method, verify the result of the
+// binary search with the measurements of one more SYNCH byte before the
+// receiver is enabled, and restart the search if one is out of tolerance. The
+// master must send two SYNCH bytes, and two more for each retry. With
+// both methods, the residual error of the final OSCCAL value is available
+// from Synch_Residual_PPM(). Uncomment to use.
+//#define SYNCH_VERIFY
+
+// SUPPLY_TRACKING: measure VCC with the ADC bandgap channel at every lock and
+// every SUPPLY_INTERVAL calls of Synch_Update_Supply() in between, learn the
+// OSCCAL change per volt from consecutive locks, and move OSCCAL by one step
+// at a time when the supply voltage changes between synchronizations. The
+// ADC is only used from the main loop. Uncomment to use.
+//#define SUPPLY_TRACKING
+#define SUPPLY_INTERVAL       10000           // Calls per VCC measurement
+#define SUPPLY_MIN_DELTA      50              // mV between locks to learn
+
+// Number of times the binary search is restarted when verification fails.
+#define SYNCH_VERIFY_RETRIES  1
+
+// SYNCH_FILTER: reject measurements outside a plausibility window around
+// TARGET_COUNT, so that a glitch on INT0 does not send the search in the
+// wrong direction, and optionally filter several measurements per search
+// step. Uncomment to use.
+//#define SYNCH_FILTER
+
+// Plausibility window, in 1/1000 of the bit period. It must cover the
+// frequency error at the start of the search: at the EEPROM default value
+// for the single synch byte method, and in the middle of the OSCCAL range
+// for the double synch byte method.
+#define SYNCH_PLAUSIBLE_PERMILLE  500
+
+// Measurements per search step with SYNCH_FILTER. Use 1, 3, 4, 6 or 10. With 3
+// the median is used, otherwise the mean without the smallest and largest
+// measurement. The master must send SYNCH_SAMPLES times as many SYNCH bytes.
+// Can also be defined on the command line.
+#if !defined(SYNCH_SAMPLES)
+#define SYNCH_SAMPLES         1
+#endif
+
+// SYNCH_TIMEOUT: abort the synchronization when the expected SYNCH edges do
+// not arrive, restore the last good OSCCAL value and enable the UART receiver
+// again. Uses the Timer/Counter0 compare match interrupt. Uncomment to use.
+//#define SYNCH_TIMEOUT
+
+// Maximum time from BREAK detection to the first SYNCH edge, in bit times.
+// This includes the rest of the BREAK and the BREAK delimiter.
+#define SYNCH_BREAK_TIMEOUT   100
+// Maximum time between two SYNCH edges, in bit times.
+#define SYNCH_EDGE_TIMEOUT    4
+
+// SYNCH_EDGE_PCINT: take the SYNCH edges from the pin change interrupt on
+// RXD instead of INT0, so the bus only needs the RXD pin. Uncomment to use.
+//#define SYNCH_EDGE_PCINT
+
+// SYNCH_SLEEP_POWER_DOWN: let sleep() enter Power-down mode instead of Idle
+// mode. The device wakes up on the low level of the BREAK on INT0.
+//#define SYNCH_SLEEP_POWER_DOWN
+
+// Oscillator start-up time after wake-up from the selected sleep mode, in
+// CPU cycles. See "System Clock and Clock Options" in the data sheet.
+#define SLEEP_WAKEUP_CYCLES   6
+
+// SYNCH_WAKE_STATS: measure the time from wake-up to lock. Needs
+// SYNCH_TIMEOUT, as the time is counted by the timeout interrupt. See
+// Synch_Wake_To_Lock(). Uncomment to use.
+//#define SYNCH_WAKE_STATS
+
+// SYNCH_INTERPOLATE: with the double synch byte method, stop the binary search
+// after three measurements, interpolate the OSCCAL value from the last two,
+// and confirm it with two more measurements instead of the neighbor search.
+// This takes five measurements, so the master sends one SYNCH byte instead
+// of two. Uncomment to use.
+//#define SYNCH_INTERPOLATE
+
+// SYNCH_DITHER: with the double synch byte method, alternate OSCCAL after lock
+// between the two values on each side of the target, found by the neighbor
+// search, so that the mean frequency is between them. The share of time at
+// each value is set from the counts measured at the two values. Uses the
+// Timer/Counter0 compare match interrupt, every 256 cycles. Uncomment to use.
+//#define SYNCH_DITHER
+
+// SYNCH_TRACE: record every measurement of SYNCH_EXT_INT_ISR, with the search
+// state, OSCCAL value and step, in a ring of SYNCH_TRACE_SIZE entries in SRAM.
+// When SYNCH_TRACE_COMMAND is received, Synch_Trace_Send() sends the ring on
+// the UART from the main loop. Decode it with tools/trace_dump.py.
+// Uncomment to use.
+//#define SYNCH_TRACE
+#define SYNCH_TRACE_SIZE      16              // Entries, a power of 2. Four
+                                              // bytes of SRAM each.
+#define SYNCH_TRACE_COMMAND   0xC3            // Received byte that requests
+                                              // the trace.
+
+// SYNCH_METHOD_AUTO_SYNCH_BYTE takes the number of SYNCH bytes from each
+// header, so the master can send one SYNCH byte for routine resynchronizations
+// and two when a precise result is needed. The first SYNCH byte runs the
+// binary search of the single synch byte method. The next character is then
+// both received and measured by a neighbor search around that result: if it
+// is a second SYNCH byte, the best neighbor is used, otherwise it is received
+// as data and the result of the first SYNCH byte is kept. A data byte of 0x55
+// directly after a one-byte header is taken as a SYNCH byte. Without
+// SYNCH_TIMEOUT, a one-byte header is only complete when the next character
+// is received.
+
+// SYNCH_METHOD_REFERENCE calibrates against a periodic reference instead of a
+// UART master. The CPU cycles in a gate of REFERENCE_GATE reference periods are
+// counted with Timer/Counter1, so a long gate resolves far less than one
+// OSCCAL step. With REFERENCE_CRYSTAL the reference is a 32.768 kHz watch
+// crystal on the asynchronous Timer/Counter2, with one period every 256
+// crystal cycles (7.8 ms). The crystal takes up to a second to settle after
+// power-up, so the first calibration may be off; call Reference_Calibrate()
+// again after that. Otherwise the reference is the rising edges on INT0 at
+// REFERENCE_FREQUENCY, for example the 1PPS output of a GPS receiver.
+//#define REFERENCE_CRYSTAL
+#define REFERENCE_FREQUENCY   1               // Hz, rising edges on INT0
+#define REFERENCE_GATE        1               // Reference periods per gate
+
+// Approximate change in frequency for one OSCCAL step, in 1/1000. Take this
+// from the "Calibrated RC oscillator" characteristics in the data sheet.
+#define OSCCAL_STEP_PERMILLE  7
+
+// Clock error at which a resynchronization is due, in 1/1000. This is the
+// recommended maximum receiver error of the UART for 8 data bits in the data
+// sheets, which leaves the rest of the receiver margin to the master.
+#if defined(SYNCH_DOUBLE_SPEED)
+#define DRIFT_TOLERANCE_PERMILLE  15
+#else
+#define DRIFT_TOLERANCE_PERMILLE  20
+#endif
+
+// Uncertainty of the count error of one lock, in counts, and the characters
+// after which drift tracking measures from a new reference lock.
+#define DRIFT_NOISE           2
+#define DRIFT_WINDOW          4096
+
+// UART clock cycles per bit.
+#if defined(SYNCH_DOUBLE_SPEED)
+#define SYNCH_UART_DIVISOR    8L
+#else
+#define SYNCH_UART_DIVISOR    16L
+#endif
+
+#if !defined(SYNCH_UBRR)
+#define SYNCH_UBRR \
+((NOMINAL_FREQUENCY + SYNCH_UART_DIVISOR * SYNCH_FREQUENCY / 2) / \
+ (SYNCH_UART_DIVISOR * SYNCH_FREQUENCY) - 1)
+#endif
+#if (SYNCH_UBRR < 0) | (SYNCH_UBRR > 4095)
+#error SYNCH_UBRR does not fit in the baud rate register
+#endif
+
+#if defined(BAUD_EXACT)
+#define TARGET_FREQUENCY \
+(SYNCH_UART_DIVISOR * (SYNCH_UBRR + 1) * SYNCH_FREQUENCY)
+// The OSCCAL range is limited. Stay within 10% of the nominal frequency.
+#if (TARGET_FREQUENCY * 10 < NOMINAL_FREQUENCY * 9) | \
+    (TARGET_FREQUENCY * 10 > NOMINAL_FREQUENCY * 11)
+#error BAUD_EXACT: TARGET_FREQUENCY is too far from NOMINAL_FREQUENCY
+#endif
+#else
+#define TARGET_FREQUENCY      NOMINAL_FREQUENCY
+// The UART runs at TARGET_FREQUENCY / (SYNCH_UART_DIVISOR * (SYNCH_UBRR + 1)).
+// More than 2% from SYNCH_FREQUENCY leaves too little margin for the master.
+#if (TARGET_FREQUENCY * 50 < SYNCH_UART_DIVISOR * (SYNCH_UBRR + 1) * \
+                             SYNCH_FREQUENCY * 49) | \
+    (TARGET_FREQUENCY * 50 > SYNCH_UART_DIVISOR * (SYNCH_UBRR + 1) * \
+                             SYNCH_FREQUENCY * 51)
+#error SYNCH_UBRR gives more than 2% baud rate error. Define BAUD_EXACT
+#endif
+#endif
+
+// Built as the ATtinyOSCCAL Arduino library. The Arduino core defines F_CPU
+// from the board, which must run the internal RC oscillator at
+// TARGET_FREQUENCY.
+#if defined(ARDUINO) & defined(F_CPU)
+#if (F_CPU != TARGET_FREQUENCY)
+#error Select a board clocked from the internal oscillator at TARGET_FREQUENCY
+#endif
+#endif
+
 
 // This file must be included after user settings
 #include "device_specific.h"
@@ -71,25 +294,249 @@
 #error TARGET_COUNT is larger than 8-bit counter
 #endif
 
+// Count error at which a resynchronization is due.
+#define DRIFT_TOLERANCE \
+((TARGET_FREQUENCY / SYNCH_FREQUENCY) * DRIFT_TOLERANCE_PERMILLE / 1000)
+
 #define COUNT_LOW_LIMIT   (TARGET_COUNT - SYNCH_LIMIT)
 #define COUNT_HIGH_LIMIT  (TARGET_COUNT + SYNCH_LIMIT)
 
-#if defined(SYNCH_METHOD_DOUBLE_SYNCH_BYTE)
+// The OSCCAL value and count error of the final measurement are stored at
+// every lock when they are needed by drift tracking or verification.
+#if defined(DRIFT_TRACKING) | defined(SYNCH_VERIFY) | \
+    defined(SUPPLY_TRACKING) | defined(ARDUINO)
+#define SYNCH_LOCK_RECORD
+#endif
+
+// Each user of the lock record clears its own bit of synchLockEvent, which
+// the interrupt service routines set to LOCK_EVENT_ALL.
+#define LOCK_EVENT_DRIFT  0x01
+#define LOCK_EVENT_SUPPLY 0x02
+#define LOCK_EVENT_USER   0x04    // ATtinyOSCCAL::update()
+#define LOCK_EVENT_ALL    0xFF
+
+#if defined(SUPPLY_TRACKING)
+#if !defined(SUPPLY_ADMUX)
+#error SUPPLY_TRACKING needs an ADC with a bandgap channel
+#endif
+#if defined(SYNCH_DITHER)
+#error SUPPLY_TRACKING can not be combined with SYNCH_DITHER
+#endif
+#if (SUPPLY_INTERVAL < 1) | (SUPPLY_INTERVAL > 65535)
+#error SUPPLY_INTERVAL must be 1 to 65535
+#endif
+// ADC prescaler for an ADC clock of 50 to 200 kHz.
+#if (TARGET_FREQUENCY <= 1600000)
+#define SUPPLY_ADC_PRESCALER  3               // fclk/8
+#elif (TARGET_FREQUENCY <= 3200000)
+#define SUPPLY_ADC_PRESCALER  4               // fclk/16
+#elif (TARGET_FREQUENCY <= 6400000)
+#define SUPPLY_ADC_PRESCALER  5               // fclk/32
+#elif (TARGET_FREQUENCY <= 12800000)
+#define SUPPLY_ADC_PRESCALER  6               // fclk/64
+#else
+#define SUPPLY_ADC_PRESCALER  7               // fclk/128
+#endif
+#endif
+
+#if defined(SYNCH_FILTER)
+#define PLAUSIBLE_LIMIT \
+((TARGET_FREQUENCY / SYNCH_FREQUENCY) * SYNCH_PLAUSIBLE_PERMILLE / 1000)
+#if (PLAUSIBLE_LIMIT >= TARGET_COUNT)
+#define PLAUSIBLE_COUNT_LOW   0
+#else
+#define PLAUSIBLE_COUNT_LOW   (TARGET_COUNT - PLAUSIBLE_LIMIT)
+#endif
+// Counts beyond the timer range cannot be measured.
+#if defined(NINE_BIT_TIMER) & ((TARGET_COUNT + PLAUSIBLE_LIMIT) > 511)
+#define PLAUSIBLE_COUNT_HIGH  511
+#elif (!defined(NINE_BIT_TIMER)) & ((TARGET_COUNT + PLAUSIBLE_LIMIT) > 255)
+#define PLAUSIBLE_COUNT_HIGH  255
+#else
+#define PLAUSIBLE_COUNT_HIGH  (TARGET_COUNT + PLAUSIBLE_LIMIT)
+#endif
+
+#if (SYNCH_SAMPLES == 1)
+#elif (SYNCH_SAMPLES == 3)
+#define SYNCH_SAMPLES_SHIFT   0
+#elif (SYNCH_SAMPLES == 4)
+#define SYNCH_SAMPLES_SHIFT   1
+#elif (SYNCH_SAMPLES == 6)
+#define SYNCH_SAMPLES_SHIFT   2
+#elif (SYNCH_SAMPLES == 10)
+#define SYNCH_SAMPLES_SHIFT   3
+#else
+#error SYNCH_SAMPLES must be 1, 3, 4, 6 or 10
+#endif
+#endif
+
+#if defined(SYNCH_TIMEOUT)
+#if !defined(SYNCH_TIMER_COMPARE_REGISTER)
+#error SYNCH_TIMEOUT needs a compare unit on Timer/Counter0
+#endif
+// The compare match interrupt occurs every 256 cycles. The compare value is
+// placed half a timer period away from TARGET_COUNT, so that the interrupt
+// never delays the INT0 interrupt of a plausible SYNCH edge.
+#define SYNCH_TIMEOUT_COMPARE ((TARGET_COUNT + 128) & 0xFF)
+// Timeouts in compare match interrupts. One is added, as the first compare
+// match after an edge comes early.
+#define BREAK_TIMEOUT_TICKS \
+((SYNCH_BREAK_TIMEOUT * (TARGET_FREQUENCY / SYNCH_FREQUENCY) + 255) / 256 + 1)
+#define EDGE_TIMEOUT_TICKS \
+((SYNCH_EDGE_TIMEOUT * (TARGET_FREQUENCY / SYNCH_FREQUENCY) + 255) / 256 + 1)
+#if (BREAK_TIMEOUT_TICKS > 255) | (EDGE_TIMEOUT_TICKS > 255)
+#error SYNCH_BREAK_TIMEOUT or SYNCH_EDGE_TIMEOUT is too long
+#endif
+#endif
+
+#if defined(SYNCH_SLEEP_POWER_DOWN)
+#define SYNCH_SLEEP_MODE      SLEEP_MODE_POWER_DOWN
+#else
+#define SYNCH_SLEEP_MODE      SLEEP_MODE_IDLE
+#endif
+
+// The device must be awake and prepared for the SYNCH byte before the BREAK
+// ends. A BREAK is at least 13 bit times; 64 cycles are allowed for the INT0
+// interrupt and PREPARE_FOR_SYNCH().
+#if (SLEEP_WAKEUP_CYCLES + 64) > (13 * (TARGET_FREQUENCY / SYNCH_FREQUENCY))
+#error SLEEP_WAKEUP_CYCLES is too long for the BREAK at SYNCH_FREQUENCY
+#endif
+
+#if defined(SYNCH_WAKE_STATS) & !defined(SYNCH_TIMEOUT)
+#error SYNCH_WAKE_STATS needs SYNCH_TIMEOUT
+#endif
+
+#if defined(SYNCH_EDGE_PCINT)
+#if !defined(SYNCH_PCINT_vect)
+#error SYNCH_EDGE_PCINT needs a pin change interrupt on RXD
+#endif
+#if defined(SYNCH_METHOD_REFERENCE)
+#error SYNCH_EDGE_PCINT needs a UART synchronization method
+#endif
+#define SYNCH_EDGE_vect       SYNCH_PCINT_vect
+#else
+#define SYNCH_EDGE_vect       SYNCH_EXT_INT_vect
+#endif
+
+#if defined(RESYNCH_REPORT)
+#if !defined(DRIFT_TRACKING)
+#error RESYNCH_REPORT needs DRIFT_TRACKING
+#endif
+#if (SYNCH_NODE_ID < 0) | (SYNCH_NODE_ID > 15)
+#error SYNCH_NODE_ID must be 0 to 15
+#endif
+#endif
+
+#if defined(SYNCH_TRACE)
+#if defined(SYNCH_METHOD_REFERENCE)
+#error SYNCH_TRACE needs a UART synchronization method
+#endif
+#if (SYNCH_TRACE_SIZE < 1) | (SYNCH_TRACE_SIZE > 64) | \
+    (SYNCH_TRACE_SIZE & (SYNCH_TRACE_SIZE - 1))
+#error SYNCH_TRACE_SIZE must be a power of 2, at most 64
+#endif
+#if (SYNCH_TRACE_COMMAND == 0x55)
+#error SYNCH_TRACE_COMMAND can not be the SYNCH byte
+#endif
+#endif
+
+#if defined(SYNCH_DITHER)
+#if !defined(SYNCH_METHOD_DOUBLE_SYNCH_BYTE)
+#error SYNCH_DITHER needs the double synch byte method
+#endif
+#if !defined(SYNCH_TIMER_COMPARE_REGISTER)
+#error SYNCH_DITHER needs a compare unit on Timer/Counter0
+#endif
+#endif
+
+// Counts per OSCCAL step, in 1/16 counts. Used for drift estimation.
+#define OSCCAL_STEP_COUNT16 \
+((TARGET_FREQUENCY / SYNCH_FREQUENCY) * OSCCAL_STEP_PERMILLE * 16 / 1000)
+
+#if defined(SYNCH_METHOD_DOUBLE_SYNCH_BYTE) | defined(SYNCH_METHOD_REFERENCE)
 #define DEFAULT_OSCCAL    ((1 << OSCCAL_RESOLUTION - 1) | DEFAULT_OSCCAL_MASK)
 #define INITIAL_STEP      (1 << (OSCCAL_RESOLUTION - 2))
 #endif
 
-#if defined(SYNCH_METHOD_SINGLE_SYNCH_BYTE)
+#if defined(SYNCH_METHOD_DOUBLE_SYNCH_BYTE)
+#if defined(SYNCH_INTERPOLATE)
+// Step size at the third measurement, and the distance between the second
+// and the third measurement.
+#define INTERPOLATE_STEP  (INITIAL_STEP >> 2)
+#define INTERPOLATE_WIDTH (INITIAL_STEP >> 1)
+// Two confirmation measurements, for five in total, one SYNCH byte.
+#define NEIGHBOR_MEASUREMENTS 2
+#else
+// The binary search and the neighbor search take ten measurements in total,
+// two SYNCH bytes.
+#define NEIGHBOR_MEASUREMENTS (10 - (OSCCAL_RESOLUTION - 1))
+#endif
+#endif
+
+#if defined(SYNCH_INTERPOLATE) & !defined(SYNCH_METHOD_DOUBLE_SYNCH_BYTE)
+#error SYNCH_INTERPOLATE needs the double synch byte method
+#endif
+
+#if defined(SYNCH_METHOD_REFERENCE)
+#if defined(REFERENCE_CRYSTAL)
+#if !defined(REFERENCE_CRYSTAL_vect)
+#error REFERENCE_CRYSTAL needs an asynchronous Timer/Counter2
+#endif
+#define REFERENCE_EDGE_FREQUENCY  (32768 / 256)   // Timer/Counter2 overflows
+#else
+#define REFERENCE_EDGE_FREQUENCY  REFERENCE_FREQUENCY
+#endif
+// Expected # of processor ticks in one gate.
+#define REFERENCE_TARGET_COUNT \
+(TARGET_FREQUENCY * REFERENCE_GATE / REFERENCE_EDGE_FREQUENCY)
+#if (REFERENCE_GATE < 1) | (REFERENCE_GATE > 255)
+#error REFERENCE_GATE must be 1 to 255
+#endif
+#if (REFERENCE_TARGET_COUNT < 10000)
+#error REFERENCE_GATE is too short for REFERENCE_FREQUENCY
+#elif (REFERENCE_TARGET_COUNT > 0x7FFFFFFF)
+#error REFERENCE_GATE is too long for REFERENCE_FREQUENCY
+#endif
+#if defined(DRIFT_TRACKING) | defined(SYNCH_VERIFY) | defined(SYNCH_FILTER) | \
+    defined(SYNCH_TIMEOUT) | defined(SUPPLY_TRACKING)
+#error The option is not supported by SYNCH_METHOD_REFERENCE
+#endif
+#endif
+
+#if defined(SYNCH_METHOD_SINGLE_SYNCH_BYTE) | defined(SYNCH_METHOD_AUTO_SYNCH_BYTE)
 #define DEFAULT_OSCCAL      defaultOSCCAL     // Default value read from EEPROM.
 #define INITIAL_STEP        (1 << 4)
 #endif
 
+#if defined(SYNCH_METHOD_SINGLE_SYNCH_BYTE)
+// Measurements of the verification, one SYNCH byte. The binary search from
+// INITIAL_STEP takes one SYNCH byte as well.
+#define VERIFY_MEASUREMENTS 5
+#endif
+
+#if defined(SYNCH_METHOD_AUTO_SYNCH_BYTE)
+// Measurements of the neighbor search, one SYNCH byte.
+#define AUTO_NEIGHBOR_MEASUREMENTS  5
+// Count error above which the character after the first SYNCH byte is not
+// measured any further, as it can not be a SYNCH byte. 1/16 of a bit, well
+// above the error of the first SYNCH byte, and below the error of a run of
+// several bits wrapped around by the timer.
+#define AUTO_HEADER_LIMIT   ((TARGET_FREQUENCY / SYNCH_FREQUENCY) / 16)
+#if defined(SYNCH_VERIFY)
+#error SYNCH_VERIFY is not supported by SYNCH_METHOD_AUTO_SYNCH_BYTE
+#endif
+#if defined(SYNCH_FILTER) & (SYNCH_SAMPLES > 1)
+#error SYNCH_METHOD_AUTO_SYNCH_BYTE needs SYNCH_SAMPLES 1
+#endif
+#endif
+
 // ***********************************************************************
 // Predefined symbols
 // ***********************************************************************
 #define SS_MEASURING        0
 #define SS_BINARY_SEARCH    1
 #define SS_NEIGHBOR_SEARCH  2
+#define SS_VERIFY           3
 
 #define FALSE               0
 #define TRUE                1
@@ -100,6 +547,26 @@
 // interrupt service routines.
 // ***********************************************************************
 
+#if defined(SYNCH_EDGE_PCINT)
+// The pin change interrupt is taken on both edges of RXD, and on changes of
+// any other pin the application enables in the same group. SYNCH_EXT_INT_ISR
+// first compares the level of RXD with
+// synchEdgeLevel, the level after the edge it waits for, and returns at
+// once on any other change. The test takes the same number of cycles for both
+// edges, so the latency from the edge to the timer read is the same for every
+// measurement and cancels out of the count like the INT0 latency does.
+// COUNTER_READ_DELAY, the time the timer is stopped, is unchanged.
+#define EDGE_IS_WANTED() \
+(((PIN_RXD & (1 << PIN_NUMBER_RXD)) ^ synchEdgeLevel) == 0)
+
+#define SET_INT0_RISING() synchEdgeLevel = (1 << PIN_NUMBER_RXD);
+#define SET_INT0_FALLING() synchEdgeLevel = 0;
+// The device wakes up on the falling edge of the BREAK instead.
+#define SET_INT0_LOW() synchEdgeLevel = 0;
+#define CLEAR_INT0_FLAG() PCINT_FLAG_REGISTER = (1 << PCINT_FLAG)
+#define DIS_INT0() PCINT_MASK_REGISTER &= ~(1 << PCINT_RXD)
+#define EN_INT0() PCINT_MASK_REGISTER |= (1 << PCINT_RXD)
+#else
 //Set external interrupt 0 to trigger on rising edge.
 #define SET_INT0_RISING() \
 EXT_INT_SENSE_CTRL_REGISTER |= (1 << ISC01) | (1 << ISC00); \
@@ -120,25 +587,258 @@ EXT_INT_FLAG_REGISTER |= (1 << INTF0);
 #define DIS_INT0() EXT_INT_MASK_REGISTER &= ~(1 << INT0)
 // Enable INT0 (external interrupt 0)
 #define EN_INT0() EXT_INT_MASK_REGISTER |= (1 << INT0)
+#define CLEAR_INT0_FLAG() EXT_INT_FLAG_REGISTER |= (1 << INTF0)
+#endif
+
+// Read the cycles since the last edge from Timer/Counter0 into count, and
+// restart the timer. With a 9-bit timer the overflow flag is the high bit, and
+// the timer is stopped for COUNTER_READ_DELAY cycles.
+#if defined(NINE_BIT_TIMER)
+#define READ_SYNCH_TIMER(count) \
+SYNCH_TIMER_PRESCALER_REGISTER &= ~((1 << CS02) | (1 << CS01) | (1 << CS00)); \
+count = TCNT0; \
+count |= ((SYNCH_TIMER_INT_FLAG_REGISTER & (1 << TOV0)) << (8 - TOV0)); \
+TCNT0 = 0; \
+SYNCH_TIMER_INT_FLAG_REGISTER = (1 << TOV0); /*Clear overflow flag.*/\
+SYNCH_TIMER_PRESCALER_REGISTER = (1 << CS00);
+#else
+#define READ_SYNCH_TIMER(count) \
+count = TCNT0; \
+TCNT0 = 0;
+#endif
+
+#if defined(SYNCH_FILTER)
+#if (SYNCH_SAMPLES > 1)
+// Take SYNCH_SAMPLES measurements per step, and use the mean of the samples
+// except the smallest and the largest.
+#define FILTER_SAMPLES() \
+if (samplesTaken == 0) \
+{ \
+    sampleSum = 0; \
+    sampleMin = 0xFFFF; \
+    sampleMax = 0; \
+} \
+sampleSum += sample; \
+if (sample < sampleMin) \
+{ \
+    sampleMin = sample; \
+} \
+if (sample > sampleMax) \
+{ \
+    sampleMax = sample; \
+} \
+if (++samplesTaken < SYNCH_SAMPLES) \
+{ \
+    SET_INT0_FALLING(); \
+    synchState = SS_MEASURING; \
+    return; \
+} \
+samplesTaken = 0; \
+sample = (sampleSum - sampleMin - sampleMax) >> SYNCH_SAMPLES_SHIFT;
+#else
+#define FILTER_SAMPLES()
+#endif
+// Filter a measurement in SYNCH_EXT_INT_ISR, which declares sample. Returns
+// from the interrupt service routine until a filtered measurement is ready.
+// Every edge taken, the start edge of a measurement as well as the end edge,
+// comes at least one bit after the edge taken before it. An edge before
+// PLAUSIBLE_COUNT_LOW is a glitch or ringing: it is ignored, and the time
+// measured so far is added to the next edge. A missed edge gives a
+// measurement that is too long: it is discarded, and a new measurement is
+// started on the next falling edge. The end of the BREAK is handled as such a
+// measurement, so ringing on it is filtered like any other glitch.
+#define FILTER_MEASUREMENT(count) \
+sample = count + glitchCarry; \
+if (sample < PLAUSIBLE_COUNT_LOW) \
+{ \
+    glitchCarry = sample + COUNTER_READ_DELAY; \
+    return; \
+} \
+glitchCarry = 0; \
+if (synchState != SS_MEASURING) \
+{ \
+    if (sample > PLAUSIBLE_COUNT_HIGH) \
+    { \
+        SET_INT0_FALLING(); \
+        synchState = SS_MEASURING; \
+        return; \
+    } \
+    FILTER_SAMPLES(); \
+    count = sample; \
+}
+#else
+#define FILTER_MEASUREMENT(count)
+#endif
+
+#if defined(SYNCH_VERIFY) & defined(SYNCH_METHOD_SINGLE_SYNCH_BYTE)
+#define PREPARE_VERIFY() \
+verifyRetries = SYNCH_VERIFY_RETRIES; \
+verifyCount = VERIFY_MEASUREMENTS; \
+verifyFailed = FALSE;
+#else
+#define PREPARE_VERIFY()
+#endif
+
+#if defined(SYNCH_FILTER) & (SYNCH_SAMPLES > 1)
+#define PREPARE_FILTER() glitchCarry = PLAUSIBLE_COUNT_HIGH + 1; samplesTaken = 0;
+#elif defined(SYNCH_FILTER)
+#define PREPARE_FILTER() glitchCarry = PLAUSIBLE_COUNT_HIGH + 1;
+#else
+#define PREPARE_FILTER()
+#endif
+
+// Edge that INT0 first waits for after the BREAK. With SYNCH_FILTER it is the
+// end of the BREAK, which FILTER_MEASUREMENT discards as too long.
+#if defined(SYNCH_FILTER)
+#define SET_FIRST_EDGE() \
+synchState = SS_BINARY_SEARCH; \
+SET_INT0_RISING();
+#else
+#define SET_FIRST_EDGE() SET_INT0_FALLING();
+#endif
+
+#if defined(SYNCH_TRACE)
+// Trace entry: synchState with bit 8 of the count in bit 7, OSCCAL before the
+// step, bits 7..0 of the count, and calStep. A BREAK is recorded with the
+// OSCCAL value it replaces, the result of the previous synchronization.
+#define SS_TRACE_BREAK      0x0F
+#define TRACE_ENTRY(state, count) \
+synchTrace[synchTraceHead] = (state) | (((count) >> 1) & 0x80); \
+synchTrace[synchTraceHead + 1] = OSCCAL; \
+synchTrace[synchTraceHead + 2] = (count); \
+synchTrace[synchTraceHead + 3] = calStep; \
+synchTraceHead = (synchTraceHead + 4) & (SYNCH_TRACE_SIZE * 4 - 1);
+// Called after the timer has been read, so the measurement is not delayed.
+#define TRACE_STEP(count) TRACE_ENTRY(synchState, count)
+#define TRACE_BREAK() TRACE_ENTRY(SS_TRACE_BREAK, 0)
+#else
+#define TRACE_STEP(count)
+#define TRACE_BREAK()
+#endif
+
+#if defined(SYNCH_WAKE_STATS)
+// Start counting when the device is woken up by a BREAK.
+#define WAKE_STATS_START() wakeTicks = 0; wakeCounting = TRUE;
+// Called from the timeout interrupt every 256 cycles.
+#define WAKE_STATS_TICK() wakeTicks++;
+// Store the time when the synchronization after a wake-up is done.
+#define WAKE_STATS_LOCKED() \
+if (wakeCounting) { synchWakeToLock = wakeTicks; wakeCounting = FALSE; }
+#else
+#define WAKE_STATS_START()
+#define WAKE_STATS_TICK()
+#define WAKE_STATS_LOCKED()
+#endif
+
+#if defined(SYNCH_TIMEOUT)
+// Start the timeout for the first SYNCH edge. With a 9-bit timer,
+// Timer/Counter0 is not running before the first synchronization.
+#define PREPARE_TIMEOUT() \
+synchTimeout = BREAK_TIMEOUT_TICKS; \
+SYNCH_TIMER_INT_FLAG_REGISTER = (1 << SYNCH_TIMER_COMPARE_FLAG); \
+SYNCH_TIMER_INT_MASK_REGISTER |= (1 << SYNCH_TIMER_COMPARE_IE); \
+SYNCH_TIMER_PRESCALER_REGISTER |= (1 << CS00);
+// Restart the timeout when a SYNCH edge has arrived.
+#define RESTART_TIMEOUT() synchTimeout = EDGE_TIMEOUT_TICKS;
+// Stop the timeout, and remember the result when the synchronization is done.
+#define STOP_TIMEOUT() \
+SYNCH_TIMER_INT_MASK_REGISTER &= ~(1 << SYNCH_TIMER_COMPARE_IE); \
+lastGoodOSCCAL = OSCCAL; \
+WAKE_STATS_LOCKED();
+#else
+#define PREPARE_TIMEOUT()
+#define RESTART_TIMEOUT()
+#define STOP_TIMEOUT()
+#endif
+
+#if defined(SYNCH_DITHER)
+// Stop dithering during the synchronization. Must be done before
+// PREPARE_TIMEOUT(), which uses the same interrupt.
+#define PREPARE_DITHER() \
+ditherDen = 0; \
+SYNCH_TIMER_INT_MASK_REGISTER &= ~(1 << SYNCH_TIMER_COMPARE_IE);
+// Start dithering if the neighbor search found values on each side of the
+// target. Must be done after STOP_TIMEOUT().
+#define START_DITHER() \
+if (ditherDen != 0) \
+{ \
+    ditherAcc = 0; \
+    SYNCH_TIMER_INT_FLAG_REGISTER = (1 << SYNCH_TIMER_COMPARE_FLAG); \
+    SYNCH_TIMER_INT_MASK_REGISTER |= (1 << SYNCH_TIMER_COMPARE_IE); \
+}
+#else
+#define PREPARE_DITHER()
+#define START_DITHER()
+#endif
+
+#if defined(ARDUINO)
+#if defined(SYNCH_TIMEOUT) | defined(SYNCH_DITHER) | defined(SYNCH_WAKE_STATS)
+#error The Timer/Counter0 interrupts are not available with ARDUINO
+#endif
+// The Arduino core runs Timer/Counter0 at fclk/64 with the overflow interrupt
+// for millis(). The interrupt is disabled while the timer is used for the
+// synchronization, as it would clear TOV0, and both are restored at the end.
+// millis() does not advance during the synchronization.
+#define CLAIM_HOST_TIMER() \
+SYNCH_TIMER_INT_MASK_REGISTER &= ~(1 << TOIE0); \
+SYNCH_TIMER_PRESCALER_REGISTER = (1 << CS00);
+#define RELEASE_HOST_TIMER() \
+SYNCH_TIMER_PRESCALER_REGISTER = (1 << CS01) | (1 << CS00); \
+SYNCH_TIMER_INT_FLAG_REGISTER = (1 << TOV0); \
+SYNCH_TIMER_INT_MASK_REGISTER |= (1 << TOIE0);
+// Received characters go to the receive buffer of the library.
+#define SYNCH_RECEIVED(data) ATtinyOSCCAL_Receive(data);
+#else
+#define CLAIM_HOST_TIMER()
+#define RELEASE_HOST_TIMER()
+// For testing, the received characters are written to PORTB.
+#define SYNCH_RECEIVED(data) PORTB = data;
+#endif
 
 #define PREPARE_FOR_SYNCH() \
+CLAIM_HOST_TIMER(); \
+TRACE_BREAK(); \
 breakDetected = TRUE; \
 synchState = SS_MEASURING; \
 calStep = INITIAL_STEP; \
+PREPARE_VERIFY(); \
+PREPARE_FILTER(); \
+PREPARE_DITHER(); \
+PREPARE_TIMEOUT(); \
 SYNCH_USART_STATCTRL_REG_B &= ~(1 << SYNCH_RXEN); /*Disable UART receiver.*/\
-SET_INT0_FALLING(); /*Set external interrupt 0 to trigger on falling edge.*/\
-EXT_INT_FLAG_REGISTER |= (1 << INTF0); \
+SET_FIRST_EDGE(); \
+CLEAR_INT0_FLAG(); \
 EN_INT0(); /*Enable external interrupt 0.*/\
 OSCCAL = DEFAULT_OSCCAL; \
 NOP();
 
+#if defined(SYNCH_METHOD_AUTO_SYNCH_BYTE)
+#if defined(SYNCH_LOCK_RECORD)
+#define SET_LOCK_EVENT() synchLockEvent = LOCK_EVENT_ALL;
+#else
+#define SET_LOCK_EVENT()
+#endif
+// Complete the synchronization when the number of SYNCH bytes in the header
+// is known, with the OSCCAL value found for it.
+#define FINISH_HEADER(osccal, bytes) \
+OSCCAL = osccal; \
+NOP(); \
+synchHeaderBytes = bytes; \
+breakDetected = FALSE; \
+SET_LOCK_EVENT(); \
+DIS_INT0(); /*Disable external interrupt 0.*/\
+STOP_TIMEOUT(); \
+RELEASE_HOST_TIMER();
+#endif
+
 // For ATmega64 and ATmega128, 8 nop instructions must be run after a
 // change in OSCCAL to ensure stability (See errata in datasheet).
 // For all other devices, one nop instruction should be run to let
 // the RC oscillator stabilize.
 // The NOP() macro takes care of this.
 #if defined(__AT90Mega64__) | defined(__ATmega64__) | \
-    defined(__AT90Mega128__) | defined(__ATmega128__)
+    defined(__AT90Mega128__) | defined(__ATmega128__) | \
+    defined(__AVR_ATmega64__) | defined(__AVR_ATmega128__)
 #define NOP() \
 __no_operation(); \
 __no_operation(); \
@@ -159,5 +859,33 @@ __no_operation();
 // Function prototypes
 // ***********************************************************************
 void Initialize_Synchronization( void );
+#if defined(DRIFT_TRACKING)
+void Synch_Update_Drift( void );
+unsigned int Synch_Time_To_Resynch( void );
+#endif
+#if defined(SYNCH_VERIFY)
+signed long Synch_Residual_PPM( void );
+#endif
+#if defined(SYNCH_WAKE_STATS)
+unsigned long Synch_Wake_To_Lock( void );
+#endif
+#if defined(RESYNCH_REPORT)
+void Synch_Report_Resynch( void );
+#endif
+#if defined(SYNCH_TRACE)
+void Synch_Trace_Send( void );
+#endif
+#if defined(SUPPLY_TRACKING)
+void Synch_Update_Supply( void );
+unsigned int Synch_Supply_Millivolts( void );
+signed int Synch_Supply_Slope( void );
+#endif
+#if defined(ARDUINO)
+void ATtinyOSCCAL_Receive( unsigned char data );
+#endif
+#if defined(SYNCH_METHOD_REFERENCE)
+void Reference_Calibrate( void );
+signed long Reference_Residual_PPM( void );
+#endif
 
 #endif
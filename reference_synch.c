@@ -0,0 +1,250 @@
+/* This file has been prepared for Doxygen automatic documentation generation.*/
+/*! \file *********************************************************************
+ *
+ * \brief
+ *      Implementation of the reference synchronization method.
+ *
+ *      This file calibrates the internal oscillator against a periodic
+ *      reference instead of the SYNCH byte of a UART master: a 32.768 kHz
+ *      watch crystal on the asynchronous Timer/Counter2, or a signal on INT0
+ *      such as the 1PPS output of a GPS receiver.
+ *
+ *      The code is split in three parts. The edge source is the interrupt
+ *      service routine of the reference, which reads the cycle counter. The
+ *      cycle counter is Timer/Counter1, extended to 32 bits by its overflow
+ *      interrupt. The search takes the number of cycles in a gate of
+ *      REFERENCE_GATE reference periods, and does a binary search over the
+ *      OSCCAL range followed by one measurement at the final value.
+ *
+ *      The timer is never stopped. The count of a gate is the difference of
+ *      two readings made at the same point of the same interrupt service
+ *      routine, so no read delay correction is needed, unlike the UART
+ *      methods. Each edge ends one gate and starts the next. An overflow
+ *      that is still pending when the edge is read is added by
+ *      READ_CYCLE_COUNTER.
+ *
+ *      The interrupt latency only cancels while it is the same for every
+ *      edge. An edge that comes while REFERENCE_OVERFLOW_ISR runs is read up
+ *      to the length of that routine later, about 45 cycles with its
+ *      interrupt response, and interrupts of the application delay it in
+ *      the same way. A gate count can therefore be off by that many cycles:
+ *      6 ppm for a 1PPS reference at 8 MHz, but 0.45 % at the shortest gate
+ *      of 10000 cycles. Choose REFERENCE_GATE so that this stays well below
+ *      one OSCCAL step.
+ *
+ *      Timer/Counter1 is stopped after the calibration, and can be used by
+ *      the application until Reference_Calibrate() is called again.
+ *
+ * \par Application note:
+ *      AVR054 Synchronization of the internal RC oscillator
+ *
+ ******************************************************************************/
+
+#include "online_synch.h"
+#include "device_specific.h"
+#include "compiler.h"
+
+#if defined(SYNCH_METHOD_REFERENCE)
+
+extern unsigned char breakDetected;     // TRUE while calibrating.
+extern unsigned char synchState;
+extern unsigned char calStep;
+
+// Upper 16 bits of the cycle counter.
+static unsigned int cycleCountHigh;
+// Cycle counter at the start of the gate, and reference edges left in it.
+static unsigned long gateStart;
+static unsigned char gateEdges;
+// Best OSCCAL value so far, and its count error.
+static unsigned char bestOSCCAL;
+static unsigned long bestDistance;
+static signed long residualError;
+
+
+// Read the 32-bit cycle counter. Must be used with interrupts disabled. An
+// overflow that has not been counted yet is added if the low part has
+// already wrapped around.
+#define READ_CYCLE_COUNTER(count) \
+{ \
+    unsigned int low = TCNT1; \
+    unsigned int high = cycleCountHigh; \
+    if ((REFERENCE_TIMER_INT_FLAG_REGISTER & (1 << TOV1)) && (low < 0x8000)) \
+    { \
+        high++; \
+    } \
+    count = ((unsigned long)high << 16) | low; \
+}
+
+
+void Initialize_Synchronization(void)
+{
+#if defined(REFERENCE_CRYSTAL)
+    // Clock Timer/Counter2 from the crystal, no prescaling. The interrupt is
+    // disabled while the clock source is changed, and the registers are
+    // written again after it. The update of each register is only complete
+    // when its busy flag in ASSR is cleared, which takes a few crystal
+    // cycles. Reference_Calibrate() clears TOV2 and enables the interrupt
+    // after that.
+    REFERENCE_CRYSTAL_INT_MASK_REGISTER &= ~(1 << TOIE2);
+    ASSR |= (1 << AS2);
+    TCNT2 = 0;
+    REFERENCE_CRYSTAL_CONTROL_REGISTER = (1 << CS20);
+    while (ASSR & REFERENCE_CRYSTAL_BUSY_MASK)
+    { // Wait until the crystal clock has taken over
+    }
+    // The loop above ends once the crystal oscillates, but its frequency
+    // needs up to a second to settle after power-up. The first calibration
+    // after power-up may therefore be off. Call Reference_Calibrate() again
+    // when the crystal has settled.
+#else
+    // Set INT0 pin as input, no internal pullup.
+    DDR_INT0 &= ~(1 << PIN_NUMBER_INT0);
+    PORT_INT0 &= ~(1 << PIN_NUMBER_INT0);
+#endif
+
+    Reference_Calibrate();
+}
+
+/*! \brief Start a calibration.
+ *
+ *  The calibration takes OSCCAL_RESOLUTION gates of REFERENCE_GATE edges
+ *  each, after one edge that only starts the first gate:
+ *  OSCCAL_RESOLUTION * REFERENCE_GATE + 1 reference edges in all.
+ *  breakDetected is TRUE until it is done.
+ */
+void Reference_Calibrate(void)
+{
+    __disable_interrupt();
+
+    breakDetected = TRUE;
+    synchState = SS_MEASURING;
+    calStep = INITIAL_STEP;
+    bestDistance = 0xFFFFFFFF;
+    OSCCAL = DEFAULT_OSCCAL;
+    NOP();
+
+    // Count the CPU clock with Timer/Counter1.
+    cycleCountHigh = 0;
+    TCCR1A = 0;
+    TCCR1B = (1 << CS10);
+    REFERENCE_TIMER_INT_FLAG_REGISTER = (1 << TOV1);
+    REFERENCE_TIMER_INT_MASK_REGISTER |= (1 << TOIE1);
+
+#if defined(REFERENCE_CRYSTAL)
+    REFERENCE_CRYSTAL_INT_FLAG_REGISTER = (1 << TOV2);
+    REFERENCE_CRYSTAL_INT_MASK_REGISTER |= (1 << TOIE2);
+#else
+    SET_INT0_RISING();
+    EN_INT0();
+#endif
+
+    __enable_interrupt();
+}
+
+/*! \brief Residual frequency error of the last calibration.
+ *
+ *  The count error of the final value, measured over a whole gate. The
+ *  resolution is one cycle per gate. A positive value means that the clock
+ *  runs fast. The application can use it to correct software timing.
+ *
+ *  \return  Frequency error in ppm.
+ */
+signed long Reference_Residual_PPM(void)
+{
+    signed long error;
+
+    __disable_interrupt();
+    error = residualError;
+    __enable_interrupt();
+
+    return (error * 1000L) / (REFERENCE_TARGET_COUNT / 1000);
+}
+
+
+/*! \brief One search step with the count error of a gate. */
+static void Search_Step(signed long error)
+{
+    unsigned long distance = ABS(error);
+
+    if (distance < bestDistance)
+    {
+        bestDistance = distance;
+        bestOSCCAL = OSCCAL;
+        residualError = error;
+    }
+
+    if (calStep != 0)
+    {
+        if (error > 0)
+        {
+            OSCCAL -= calStep;
+            NOP();
+        }
+        else if (error < 0)
+        {
+            OSCCAL += calStep;
+            NOP();
+        }
+        calStep >>= 1;
+        return;
+    }
+
+    // The final value has been measured. Use the best one, and release the
+    // timers.
+    OSCCAL = bestOSCCAL;
+    NOP();
+#if defined(REFERENCE_CRYSTAL)
+    REFERENCE_CRYSTAL_INT_MASK_REGISTER &= ~(1 << TOIE2);
+#else
+    DIS_INT0();
+#endif
+    REFERENCE_TIMER_INT_MASK_REGISTER &= ~(1 << TOIE1);
+    TCCR1B = 0;
+    breakDetected = FALSE;
+}
+
+/*! \brief Count a reference period, and run a search step after each gate. */
+static void Reference_Edge(unsigned long now)
+{
+    if (synchState == SS_MEASURING)
+    {
+        // First edge, start the first gate.
+        synchState = SS_BINARY_SEARCH;
+    }
+    else if (--gateEdges != 0)
+    {
+        return;
+    }
+    else
+    {
+        Search_Step((signed long)(now - gateStart) - REFERENCE_TARGET_COUNT);
+        if (!breakDetected)
+        {
+            return;
+        }
+    }
+    gateStart = now;
+    gateEdges = REFERENCE_GATE;
+}
+
+
+SYNCH_ISR(REFERENCE_TIMER_OVF_vect, REFERENCE_OVERFLOW_ISR)
+{
+    cycleCountHigh++;
+}
+
+// The cycle counter is read first, so that the latency is the same for
+// every edge.
+#if defined(REFERENCE_CRYSTAL)
+SYNCH_ISR(REFERENCE_CRYSTAL_vect, REFERENCE_EDGE_ISR)
+#else
+SYNCH_ISR(SYNCH_EXT_INT_vect, REFERENCE_EDGE_ISR)
+#endif
+{
+    unsigned long now;
+
+    READ_CYCLE_COUNTER(now);
+    Reference_Edge(now);
+}
+
+#endif
@@ -6,9 +6,7 @@
  *
  *      This file contain the implementation of the single SYNCH byte
  *      synchronization method. The UART RXC interrupt service routine (ISR) is
- *      a part of this implementation. To implement a communication protocol,
- *      code to handle reception of UART data must be added in this file or
- *      double_synch_byte.c depending on which method is used.
+ *      shared with the other SYNCH byte methods, see synch_uart.c.
  *
  * \par Application note:
  *      AVR054 Synchronization of the internal RC oscillator
@@ -29,111 +27,138 @@
 
 #include "online_synch.h"
 #include "device_specific.h"
-#include <ioavr.h>
-#include <inavr.h>
+#include "compiler.h"
 
 #if defined(SYNCH_METHOD_SINGLE_SYNCH_BYTE)
 
 extern unsigned char breakDetected;
 extern unsigned char calStep;
+extern unsigned char defaultOSCCAL;
+#if defined(SYNCH_EDGE_PCINT)
+extern unsigned char synchEdgeLevel;
+#endif
+#if defined(SYNCH_TIMEOUT)
+extern unsigned char synchTimeout;
+extern unsigned char lastGoodOSCCAL;
+#endif
+#if defined(SYNCH_TRACE)
+extern unsigned char synchTrace[];
+extern unsigned char synchTraceHead;
+#endif
+#if defined(SYNCH_WAKE_STATS)
+extern unsigned char wakeCounting;
+extern unsigned int wakeTicks;
+extern unsigned int synchWakeToLock;
+#endif
 extern unsigned char synchState; // First set to SS_MEASURING within PREPARE_FOR_SYNCH() routine.
 
-unsigned char defaultOSCCAL;
-
-void Initialize_Synchronization(void)
-{
-    // Initialize UART.
-    SYNCH_USART_STATCTRL_REG_B |= (1 << SYNCH_RXEN) | (1 << SYNCH_RXCIE);
-    SYNCH_UBRRH = (SYNCH_UBRR >> 8); //Set baud rate registers
-    SYNCH_UBRRL = (SYNCH_UBRR & 0x00ff);
-
-    // Set INT0 pin as input, no internal pullup.
-    DDR_INT0 &= ~(1 << PIN_NUMBER_INT0);
-    PORT_INT0 &= ~(1 << PIN_NUMBER_INT0);
-
-    // If 8 bit timer is used, it must be started here.
-    #if ! defined(NINE_BIT_TIMER)
-    SYNCH_TIMER_PRESCALER_REGISTER |= (1 << CS00); // Timer/Counter1 runs at fclk. (no prescaling)
-    #endif
-
-    // Read default OSCCAL value from EEPROM.
-    while(EECR & (1 << EEPROM_WRITE_ENABLE))
-    { // Wait if EEPROM is busy writing
-    }
-    EEAR = DEFAULT_OSCCAL_ADDRESS;
-    EECR |= (1 << EERE);
-    defaultOSCCAL = EEDR;
-}
+#if defined(SYNCH_LOCK_RECORD)
+extern unsigned char synchLockEvent;
+extern unsigned char synchLockOSCCAL;
+extern signed int synchLockError;
+#endif
+#if defined(DRIFT_TRACKING)
+extern unsigned int synchCharCount;
+#endif
+#if defined(SYNCH_VERIFY)
+unsigned char verifyRetries;
+unsigned char verifyCount;      // Measurements left in the verification byte.
+unsigned char verifyFailed;     // A measurement of it is out of tolerance.
+#endif
 
+#if defined(SYNCH_FILTER)
+unsigned int glitchCarry;
+#if (SYNCH_SAMPLES > 1)
+unsigned char samplesTaken;
+static unsigned int sampleSum;
+static unsigned int sampleMin;
+static unsigned int sampleMax;
+#endif
+#endif
 
-#pragma vector=SYNCH_USART_RXC_vect
-__interrupt void UART_RXC_ISR(void)
+#if defined(SYNCH_TIMEOUT)
+SYNCH_ISR(SYNCH_TIMER_COMPARE_vect, SYNCH_TIMEOUT_ISR)
 {
-    unsigned char temp;
-    if (SYNCH_USART_STATCTRL_REG_A & (1 << SYNCH_FE))  // Frame error has occured.
+    WAKE_STATS_TICK();
+    if (--synchTimeout == 0)
     {
-        PREPARE_FOR_SYNCH();
-    }
-    else
-    {
-        // Process character received by UART receiver.
-        // It is necessary that the UART data register is read at this point
-        // to clear the receive buffer. If the value read is not used, the
-        // compiler will optimize away the reading of UART data register. In
-        // this case the synchronization will not work.
-        temp = SYNCH_UDR;
-        PORTB = temp;
+        // No SYNCH edge in time. Give up, and restore the result of the
+        // last successful synchronization.
+        breakDetected = FALSE;
+        OSCCAL = lastGoodOSCCAL;
+        NOP();
+
+        // Disable INT0 (external interrupt 0)
+        DIS_INT0();
+        SYNCH_TIMER_INT_MASK_REGISTER &= ~(1 << SYNCH_TIMER_COMPARE_IE);
+
+        // Enable UART receiver.
+        SYNCH_USART_STATCTRL_REG_B |= (1 << SYNCH_RXEN);
     }
 }
+#endif
 
 // Force no optimization for this ISR.
-// If this is changed, the timing will not be correct.
+// If this is changed, the timing will not be correct. With avr-gcc, "make
+// report" fails if the read delay differs from COUNTER_READ_DELAY.
+#if defined(__IAR_SYSTEMS_ICC__)
 #pragma optimize=z 2
-#pragma vector=SYNCH_EXT_INT_vect
-__interrupt void SYNCH_EXT_INT_ISR(void)
+#endif
+SYNCH_ISR(SYNCH_EDGE_vect, SYNCH_EXT_INT_ISR)
 {
 #if defined(NINE_BIT_TIMER)
     unsigned int cycleCount;
 #else
     unsigned char cycleCount;
 #endif
+#if defined(SYNCH_FILTER)
+    unsigned int sample;
+#endif
 
-#if defined(NINE_BIT_TIMER)
-    // Stop Timer/Counter0.
-    SYNCH_TIMER_PRESCALER_REGISTER &= ~((1 << CS02) | (1 << CS01) | (1 << CS00));
-
-    // Read Timer/Counter0.
-    cycleCount = TCNT0; // Retrieve the low 8 bits.
-	// Use the overflow flag as the high bit of a 9-bit timer.
-    cycleCount |= ((SYNCH_TIMER_INT_FLAG_REGISTER & (1 << TOV0)) << (8 - TOV0));
-
-    // Reset Timer/Counter0.
-    TCNT0 = 0;
-    SYNCH_TIMER_INT_FLAG_REGISTER = (1 << TOV0);   // Clear overflow flag.
-
-    // Start Timer/Counter0.
-    SYNCH_TIMER_PRESCALER_REGISTER = (1 << CS00);   // Timer/Counter1 runs at fclk. (no prescaling)
-#else
-    // Read Timer/Counter0.
-    cycleCount = TCNT0;
-
-    // Reset Timer/Counter0.
-    TCNT0 = 0;
+#if defined(SYNCH_EDGE_PCINT)
+    // Ignore the edge that is not awaited, and changes of other pins. This
+    // runs before the timer is read, in the same time for either edge.
+    if (!EDGE_IS_WANTED())
+    {
+        return;
+    }
 #endif
 
+    READ_SYNCH_TIMER(cycleCount);
+
     if (breakDetected)
     {
+        RESTART_TIMEOUT();
+
+        FILTER_MEASUREMENT(cycleCount);
+        TRACE_STEP(cycleCount);
+
         switch(synchState) {
             case (SS_MEASURING):
             {
                 //Set external interrupt 0 to trigger on rising edge.
                 SET_INT0_RISING();
 
+#if defined(SYNCH_VERIFY)
+                if (calStep == 0)
+                {
+                    synchState = SS_VERIFY;
+                    break;
+                }
+#endif
                 synchState = SS_BINARY_SEARCH;
                 break;
             }
             case (SS_BINARY_SEARCH):
             {
+#if defined(SYNCH_LOCK_RECORD) & !defined(SYNCH_VERIFY)
+                if (calStep == 1)
+                {
+                    // Last measurement. Store it before OSCCAL is adjusted.
+                    synchLockOSCCAL = OSCCAL;
+                    synchLockError = cycleCount - TARGET_COUNT;
+                }
+#endif
                 if ( cycleCount > COUNT_HIGH_LIMIT)
                 {
                     OSCCAL -= calStep;
@@ -150,17 +175,30 @@ __interrupt void SYNCH_EXT_INT_ISR(void)
                 }
                 calStep >>= 1;   // Divide by 2.
 
+#if defined(SYNCH_VERIFY)
+                // When the binary search is complete, the result is verified
+                // by one more measurement before the receiver is enabled.
+                //Set external interrupt 0 to trigger on falling edge.
+                SET_INT0_FALLING();
+
+                synchState = SS_MEASURING;
+#else
                 if (calStep == 0)
                 {
                     // Binary search complete. Clean up, and exit.
 
                     breakDetected = FALSE;
+#if defined(SYNCH_LOCK_RECORD)
+                    synchLockEvent = LOCK_EVENT_ALL;
+#endif
 
                     // Enable UART receiver.
                     SYNCH_USART_STATCTRL_REG_B |= (1 << SYNCH_RXEN);
 
                     // Disable INT0 (external interrupt 0)
                     DIS_INT0();
+                    STOP_TIMEOUT();
+                    RELEASE_HOST_TIMER();
                 }
                 else
                 {
@@ -169,8 +207,64 @@ __interrupt void SYNCH_EXT_INT_ISR(void)
 
                     synchState = SS_MEASURING;
                 }
+#endif
+                break;
+            }
+#if defined(SYNCH_VERIFY)
+            case (SS_VERIFY):
+            {
+                // The verification takes all measurements of one SYNCH byte,
+                // so that the receiver is enabled at its stop bit, and a
+                // retry starts at the next SYNCH byte.
+                if ((cycleCount > COUNT_HIGH_LIMIT) ||
+                    (cycleCount < COUNT_LOW_LIMIT))
+                {
+                    verifyFailed = TRUE;
+                }
+                if (--verifyCount != 0)
+                {
+                    //Set external interrupt 0 to trigger on falling edge.
+                    SET_INT0_FALLING();
+
+                    synchState = SS_MEASURING;
+                    break;
+                }
+
+                if (verifyFailed && (verifyRetries != 0))
+                {
+                    // Out of tolerance. Restart the binary search on the
+                    // next SYNCH byte.
+                    verifyRetries--;
+                    verifyCount = VERIFY_MEASUREMENTS;
+                    verifyFailed = FALSE;
+                    OSCCAL = DEFAULT_OSCCAL;
+                    NOP();
+                    calStep = INITIAL_STEP;
+
+                    //Set external interrupt 0 to trigger on falling edge.
+                    SET_INT0_FALLING();
+
+                    synchState = SS_MEASURING;
+                    break;
+                }
+
+                // Verified, or no retries left. Clean up, and exit.
+                synchLockOSCCAL = OSCCAL;
+                synchLockError = cycleCount - TARGET_COUNT;
+                synchLockEvent = LOCK_EVENT_ALL;
+
+                breakDetected = FALSE;
+
+                // Enable UART receiver.
+                SYNCH_USART_STATCTRL_REG_B |= (1 << SYNCH_RXEN);
+
+                // Disable INT0 (external interrupt 0)
+                DIS_INT0();
+                STOP_TIMEOUT();
+                RELEASE_HOST_TIMER();
                 break;
             }
+#endif
         }
         return;
     }
@@ -178,7 +272,8 @@ __interrupt void SYNCH_EXT_INT_ISR(void)
     {
         // Disable sleep flag. (Ensures that the device
         // does not enter any sleep mode unintended.)
-        MCUCR &= ~(1 << SE);
+        SLEEP_CTRL_REGISTER &= ~(1 << SE);
+        WAKE_STATS_START();
         PREPARE_FOR_SYNCH();
         return;
     }
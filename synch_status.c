@@ -0,0 +1,556 @@
+/* This file has been prepared for Doxygen automatic documentation generation.*/
+/*! \file *********************************************************************
+ *
+ * \brief
+ *      Lock status, residual error, drift estimation, supply voltage
+ *      compensation and the calibration trace.
+ *
+ *      This file contains functions that evaluate the result of each
+ *      synchronization. They are independent of the synchronization method
+ *      and are run from the main loop, never from an interrupt service
+ *      routine. The interrupt service routines only store the raw values
+ *      at lock and set synchLockEvent.
+ *
+ *      Time is counted in characters received by the UART since the last
+ *      lock. This is the only time base shared with the master, which can
+ *      count the characters it transmits in the same way.
+ *
+ * \par Application note:
+ *      AVR054 Synchronization of the internal RC oscillator
+ *
+ * \par Documentation:
+ *      For comprehensive code documentation, supported compilers, compiler
+ *      settings and supported devices see readme.html
+ *
+ ******************************************************************************/
+
+#include "online_synch.h"
+#include "device_specific.h"
+#include "compiler.h"
+
+#if defined(SYNCH_LOCK_RECORD)
+// Written by the synchronization ISRs at lock.
+unsigned char synchLockEvent;   // Set at lock, see LOCK_EVENT_ALL.
+unsigned char synchLockOSCCAL;  // OSCCAL value of the last lock measurement.
+signed int synchLockError;      // cycleCount - TARGET_COUNT at that value.
+#endif
+
+#if defined(SYNCH_VERIFY)
+/*! \brief Residual frequency error after the last lock.
+ *
+ *  Calculated from the count error of the final measurement, which is the
+ *  last verification measurement with the single synch byte method and the
+ *  best neighbor with the double synch byte method. A positive value means
+ *  that the clock runs fast. The resolution is one timer count, that is
+ *  1000000 / (TARGET_FREQUENCY / SYNCH_FREQUENCY) ppm. The application can
+ *  use the value to compensate software timing.
+ *
+ *  \return  Frequency error in ppm.
+ */
+signed long Synch_Residual_PPM(void)
+{
+    signed int lockError;
+
+    __disable_interrupt();
+    lockError = synchLockError;
+    __enable_interrupt();
+
+    return ((signed long)lockError * 1000000L) /
+           (TARGET_FREQUENCY / SYNCH_FREQUENCY);
+}
+#endif
+
+#if defined(SYNCH_WAKE_STATS)
+extern unsigned int synchWakeToLock;
+
+/*! \brief Time from the last wake-up to lock.
+ *
+ *  The time is counted by the timeout interrupt in steps of 256 cycles, from
+ *  the INT0 wake-up interrupt to the end of the synchronization. The
+ *  oscillator start-up time before the interrupt is added.
+ *
+ *  \return  Wake-up to lock time in microseconds.
+ */
+unsigned long Synch_Wake_To_Lock(void)
+{
+    unsigned int ticks;
+
+    __disable_interrupt();
+    ticks = synchWakeToLock;
+    __enable_interrupt();
+
+    // TARGET_FREQUENCY is not a whole number of MHz with BAUD_EXACT. The
+    // cycles times 1000000 need more than 32 bits.
+    return (unsigned long)((((unsigned long long)ticks * 256 +
+                             SLEEP_WAKEUP_CYCLES) * 1000000) /
+                           TARGET_FREQUENCY);
+}
+#endif
+
+#if defined(SYNCH_TRACE) | defined(RESYNCH_REPORT)
+
+extern unsigned char breakDetected;
+
+// Polled transmission from the main loop. The transmitter is only enabled
+// while a reply is sent.
+static void Uart_Put(unsigned char data, unsigned char last)
+{
+    while (!(SYNCH_USART_STATCTRL_REG_A & (1 << SYNCH_UDRE)))
+    { // Wait until the transmit buffer is empty
+    }
+    if (last)
+    {
+        // Clear TXC by writing 1, so that it is set when this byte has been
+        // sent. FE, DOR and UPE must be written 0.
+        SYNCH_USART_STATCTRL_REG_A = (SYNCH_USART_STATCTRL_REG_A &
+                                      ((1 << SYNCH_U2X) | (1 << SYNCH_MPCM))) |
+                                     (1 << SYNCH_TXC);
+    }
+    SYNCH_UDR = data;
+}
+
+// Disable the transmitter. complete is TRUE if the last byte was passed to
+// Uart_Put() with last set, and is waited for.
+static void Uart_Release(unsigned char complete)
+{
+    if (complete)
+    {
+        while (!(SYNCH_USART_STATCTRL_REG_A & (1 << SYNCH_TXC)))
+        { // Wait until the last byte has been sent
+        }
+    }
+    // Otherwise this takes effect when the byte in progress is sent.
+    SYNCH_USART_STATCTRL_REG_B &= ~(1 << SYNCH_TXEN);
+}
+
+#endif
+
+#if defined(SYNCH_TRACE)
+
+// Written by SYNCH_EXT_INT_ISR and PREPARE_FOR_SYNCH(), see TRACE_ENTRY().
+unsigned char synchTrace[SYNCH_TRACE_SIZE * 4];
+unsigned char synchTraceHead;       // Byte index of the oldest entry.
+unsigned char synchTraceRequest;    // Set by UART_RXC_ISR.
+
+/*! \brief Send the calibration trace on the UART.
+ *
+ *  Must be called regularly from the main loop. When SYNCH_TRACE_COMMAND has
+ *  been received, SYNCH_TRACE_SIZE and the current OSCCAL value are sent,
+ *  followed by the entries of the trace ring, oldest first. The entries are
+ *  only written during a synchronization, so the ring does not change while
+ *  it is sent after lock. A BREAK ends the transfer early.
+ *
+ *  The transmitter is enabled for the transfer only. On a single wire bus the
+ *  master must wait for it, and the bytes sent are also received. The request
+ *  is therefore cleared at the end, so an echoed SYNCH_TRACE_COMMAND does not
+ *  start another transfer.
+ */
+void Synch_Trace_Send(void)
+{
+    unsigned char index;
+    unsigned char i;
+
+    if (!synchTraceRequest || breakDetected)
+    {
+        return;
+    }
+
+    SYNCH_USART_STATCTRL_REG_B |= (1 << SYNCH_TXEN);
+    Uart_Put(SYNCH_TRACE_SIZE, FALSE);
+    Uart_Put(OSCCAL, FALSE);
+    index = synchTraceHead;
+    for (i = 0; i < SYNCH_TRACE_SIZE * 4; i++)
+    {
+        if (breakDetected)
+        {
+            break;
+        }
+        Uart_Put(synchTrace[index], (i == SYNCH_TRACE_SIZE * 4 - 1));
+        index = (index + 1) & (SYNCH_TRACE_SIZE * 4 - 1);
+    }
+    Uart_Release(i == SYNCH_TRACE_SIZE * 4);
+    synchTraceRequest = FALSE;
+}
+
+#endif
+
+#if defined(DRIFT_TRACKING)
+
+unsigned int synchCharCount;    // Characters received since the last lock.
+
+// Lock the drift is measured from, the characters received since, and the
+// current estimate.
+static unsigned char refLockOSCCAL;
+static signed int refLockError;
+static unsigned int refLockChars;
+static unsigned char refLockValid;
+static unsigned int resynchChars = 0xFFFF;
+
+/*! \brief Update the drift estimate after a lock.
+ *
+ *  Must be called regularly from the main loop. When a new lock has been
+ *  reached, the drift since the reference lock is calculated by comparing the
+ *  count each lock would have measured at the same OSCCAL value. The drift
+ *  rate is then used to estimate how many characters can be received before
+ *  the error exceeds DRIFT_TOLERANCE.
+ *
+ *  The count error of a single lock is only known to about one count, so the
+ *  drift is measured over all characters since the reference lock, and
+ *  DRIFT_NOISE is added to it. Each interval is then longer than the
+ *  characters measured so far, until the drift itself dominates. The
+ *  reference moves to the current lock when DRIFT_WINDOW characters have
+ *  been received since it.
+ */
+void Synch_Update_Drift(void)
+{
+    unsigned char lockOSCCAL;
+    signed int lockError;
+    unsigned int interval;
+    signed long drift16;
+    signed long margin16;
+    unsigned long chars;
+    unsigned long baseline = 0;
+
+    if (!(synchLockEvent & LOCK_EVENT_DRIFT))
+    {
+        return;
+    }
+
+    // The values are written from interrupt context and are not read
+    // atomically.
+    __disable_interrupt();
+    lockOSCCAL = synchLockOSCCAL;
+    lockError = synchLockError;
+    interval = synchCharCount;
+    synchCharCount = 0;
+    synchLockEvent &= ~LOCK_EVENT_DRIFT;
+    __enable_interrupt();
+
+    if (refLockValid)
+    {
+        baseline = (unsigned long)refLockChars + interval;
+
+        // Drift in 1/16 counts, referred to the reference OSCCAL value.
+        drift16 = ((signed long)(lockError - refLockError) * 16) -
+                  ((signed long)((signed int)lockOSCCAL - refLockOSCCAL) *
+                   OSCCAL_STEP_COUNT16);
+        drift16 = ABS(drift16) + DRIFT_NOISE * 16;
+
+        margin16 = (signed long)(DRIFT_TOLERANCE - ABS(lockError)) * 16;
+
+        if ((margin16 <= 0) || (baseline == 0))
+        {
+            resynchChars = 0;
+        }
+        else
+        {
+            chars = (unsigned long)margin16 * baseline / drift16;
+            resynchChars = (chars > 0xFFFE) ? 0xFFFE : (unsigned int)chars;
+        }
+    }
+
+    if (!refLockValid || (baseline >= DRIFT_WINDOW))
+    {
+        refLockOSCCAL = lockOSCCAL;
+        refLockError = lockError;
+        refLockChars = 0;
+        refLockValid = TRUE;
+    }
+    else
+    {
+        refLockChars = (unsigned int)baseline;
+    }
+}
+
+/*! \brief Characters left until a resynchronization is due.
+ *
+ *  Returns the estimate from the last call to Synch_Update_Drift(), minus
+ *  the characters received since the last lock. 0xFFFF means that no drift
+ *  has been measured yet. The protocol layer can report this value to the
+ *  master, which uses it to schedule the next BREAK/SYNCH header.
+ */
+unsigned int Synch_Time_To_Resynch(void)
+{
+    unsigned int elapsed;
+
+    if (resynchChars == 0xFFFF)
+    {
+        return 0xFFFF;
+    }
+
+    __disable_interrupt();
+    elapsed = synchCharCount;
+    __enable_interrupt();
+
+    return (elapsed < resynchChars) ? (resynchChars - elapsed) : 0;
+}
+
+#if defined(RESYNCH_REPORT)
+
+unsigned char resynchQuery;         // Set by UART_RXC_ISR.
+
+/*! \brief Answer a query from the master with Synch_Time_To_Resynch().
+ *
+ *  Must be called regularly from the main loop. When RESYNCH_QUERY +
+ *  SYNCH_NODE_ID has been received, the characters left are sent in two
+ *  bytes of 7 bits, low bits first, limited to RESYNCH_REPORT_MAX, or
+ *  RESYNCH_REPORT_UNKNOWN before the drift has been measured. Both
+ *  bytes are below 0x80, so they are never taken as a query by the other
+ *  nodes. As with Synch_Trace_Send(), the query is cleared after the reply,
+ *  which is also received on a single wire bus.
+ */
+void Synch_Report_Resynch(void)
+{
+    unsigned int chars;
+
+    if (!resynchQuery || breakDetected)
+    {
+        return;
+    }
+
+    chars = Synch_Time_To_Resynch();
+    if (chars == 0xFFFF)
+    {
+        chars = RESYNCH_REPORT_UNKNOWN;     // No drift measured yet.
+    }
+    else if (chars > RESYNCH_REPORT_MAX)
+    {
+        chars = RESYNCH_REPORT_MAX;
+    }
+    SYNCH_USART_STATCTRL_REG_B |= (1 << SYNCH_TXEN);
+    Uart_Put(chars & 0x7F, FALSE);
+    Uart_Put(chars >> 7, TRUE);
+    Uart_Release(TRUE);
+    resynchQuery = FALSE;
+}
+
+#endif
+
+#endif
+
+#if defined(SUPPLY_TRACKING)
+
+extern unsigned char breakDetected;
+
+// Range of OSCCAL values used by the synchronization.
+#define SUPPLY_OSCCAL_MIN   DEFAULT_OSCCAL_MASK
+#define SUPPLY_OSCCAL_MAX   (DEFAULT_OSCCAL_MASK + (1 << OSCCAL_RESOLUTION) - 1)
+
+// Conversions left in the measurement in progress. The first conversion after
+// the ADC is enabled is discarded while the bandgap reference settles.
+static unsigned char supplyConversions;
+static unsigned char supplyAtLock;      // The measurement belongs to a lock.
+static unsigned int supplyCountdown;    // Calls until the next measurement.
+static unsigned int supplyMillivolts;
+
+// Lock waiting for its measurement. OSCCAL is the value the synchronization
+// left, and Ideal16 the value that gives TARGET_FREQUENCY, in 1/16 steps.
+static unsigned char pendingOSCCAL;
+static signed int pendingIdeal16;
+
+// Last lock, which OSCCAL is adjusted from.
+static unsigned char supplyLockOSCCAL;
+static unsigned int supplyLockMillivolts;
+static unsigned char supplyLockValid;
+
+// Lock the slope was last learned from, and the slope in 1/16 steps per volt.
+static signed int anchorIdeal16;
+static unsigned int anchorMillivolts;
+static unsigned char anchorValid;
+static signed int supplySlope16;
+static unsigned char slopeValid;
+
+static void Start_Supply_Measurement(void)
+{
+    ADMUX = SUPPLY_ADMUX;
+    ADCSRA = (1 << ADEN) | (1 << ADSC) | SUPPLY_ADC_PRESCALER;
+    supplyConversions = 2;
+}
+
+/*! \brief Learn the slope from the lock just measured. */
+static void Supply_Learn(void)
+{
+    signed long deltaMillivolts;
+    signed long slope16;
+
+    if (anchorValid)
+    {
+        deltaMillivolts = (signed long)supplyMillivolts - anchorMillivolts;
+        if (ABS(deltaMillivolts) < SUPPLY_MIN_DELTA)
+        {
+            // Too close to tell the supply from the drift. Keep the anchor
+            // until the supply has moved far enough.
+            supplyLockOSCCAL = pendingOSCCAL;
+            supplyLockMillivolts = supplyMillivolts;
+            supplyLockValid = TRUE;
+            return;
+        }
+        slope16 = ((signed long)(pendingIdeal16 - anchorIdeal16) * 1000) /
+                  deltaMillivolts;
+        supplySlope16 = slopeValid ? (signed int)((supplySlope16 + slope16) / 2)
+                                   : (signed int)slope16;
+        slopeValid = TRUE;
+    }
+
+    anchorIdeal16 = pendingIdeal16;
+    anchorMillivolts = supplyMillivolts;
+    anchorValid = TRUE;
+    supplyLockOSCCAL = pendingOSCCAL;
+    supplyLockMillivolts = supplyMillivolts;
+    supplyLockValid = TRUE;
+}
+
+/*! \brief Move OSCCAL one step towards the value for the measured supply. */
+static void Supply_Compensate(void)
+{
+    signed long offset16;
+    signed int target;
+
+    if (!slopeValid || !supplyLockValid)
+    {
+        return;
+    }
+
+    offset16 = (signed long)supplySlope16 *
+               ((signed long)supplyMillivolts - supplyLockMillivolts) / 1000;
+    target = supplyLockOSCCAL + (signed int)((offset16 >= 0) ?
+                                             ((offset16 + 8) / 16) :
+                                             -((8 - offset16) / 16));
+    if (target < SUPPLY_OSCCAL_MIN)
+    {
+        target = SUPPLY_OSCCAL_MIN;
+    }
+    else if (target > SUPPLY_OSCCAL_MAX)
+    {
+        target = SUPPLY_OSCCAL_MAX;
+    }
+
+    // Leave OSCCAL alone while a synchronization is in progress.
+    __disable_interrupt();
+    if (!breakDetected)
+    {
+        if (OSCCAL < target)
+        {
+            OSCCAL++;
+            NOP();
+        }
+        else if (OSCCAL > target)
+        {
+            OSCCAL--;
+            NOP();
+        }
+    }
+    __enable_interrupt();
+}
+
+/*! \brief Track the supply voltage and compensate OSCCAL for it.
+ *
+ *  Must be called regularly from the main loop. It never waits for the ADC:
+ *  each call either starts a conversion, finds it still running, or reads
+ *  the result. VCC is measured after every lock and after every
+ *  SUPPLY_INTERVAL calls otherwise, and the ADC is turned off in between.
+ *
+ *  The OSCCAL value that would give TARGET_FREQUENCY is known at each lock
+ *  from the count error. Two locks at least SUPPLY_MIN_DELTA apart give the
+ *  OSCCAL change per volt, which is averaged over the locks. Between locks,
+ *  OSCCAL is moved by one step per measurement towards the value the slope
+ *  gives for the measured supply.
+ */
+void Synch_Update_Supply(void)
+{
+    unsigned char lockOSCCAL;
+    signed int lockError;
+    unsigned int result;
+
+    if (synchLockEvent & LOCK_EVENT_SUPPLY)
+    {
+        // The lock record is taken at the last measurement, which may be
+        // before the last search step. Compensation starts from the OSCCAL
+        // value in use after the lock, so it is read here, unless the next
+        // synchronization has already started.
+        __disable_interrupt();
+        if (breakDetected)
+        {
+            __enable_interrupt();
+            return;
+        }
+        pendingOSCCAL = OSCCAL;
+        lockOSCCAL = synchLockOSCCAL;
+        lockError = synchLockError;
+        synchLockEvent &= ~LOCK_EVENT_SUPPLY;
+        __enable_interrupt();
+
+        pendingIdeal16 = ((signed int)lockOSCCAL * 16) -
+                         (signed int)(((signed long)lockError * 256) /
+                                      OSCCAL_STEP_COUNT16);
+        supplyAtLock = TRUE;
+        if (supplyConversions == 0)
+        {
+            Start_Supply_Measurement();
+        }
+        return;
+    }
+
+    if (supplyConversions == 0)
+    {
+        if (supplyCountdown != 0)
+        {
+            supplyCountdown--;
+        }
+        else
+        {
+            Start_Supply_Measurement();
+        }
+        return;
+    }
+
+    if (ADCSRA & (1 << ADSC))
+    {
+        return;
+    }
+    result = ADCL;
+    result |= (unsigned int)ADCH << 8;
+    if (--supplyConversions != 0)
+    {
+        ADCSRA |= (1 << ADSC);
+        return;
+    }
+    ADCSRA = 0;
+    supplyCountdown = SUPPLY_INTERVAL - 1;
+    if (result == 0)
+    {
+        return;
+    }
+    supplyMillivolts = (unsigned int)((BANDGAP_MILLIVOLTS * 1024UL) / result);
+
+    if (supplyAtLock)
+    {
+        supplyAtLock = FALSE;
+        Supply_Learn();
+    }
+    else
+    {
+        Supply_Compensate();
+    }
+}
+
+/*! \brief Supply voltage of the last measurement.
+ *
+ *  \return  VCC in mV, 0 before the first measurement.
+ */
+unsigned int Synch_Supply_Millivolts(void)
+{
+    return supplyMillivolts;
+}
+
+/*! \brief Learned OSCCAL change per volt.
+ *
+ *  \return  Slope in 1/16 OSCCAL steps per volt, 0 until two locks have been
+ *           measured at different supply voltages.
+ */
+signed int Synch_Supply_Slope(void)
+{
+    return slopeValid ? supplySlope16 : 0;
+}
+
+#endif
@@ -0,0 +1,169 @@
+/* This file has been prepared for Doxygen automatic documentation generation.*/
+/*! \file *********************************************************************
+ *
+ * \brief
+ *      UART part of the SYNCH byte methods.
+ *
+ *      This file contains the initialization and the UART RXC interrupt
+ *      service routine (ISR) shared by the single, double and auto SYNCH byte
+ *      methods. A BREAK is received as a frame error, and starts the
+ *      synchronization. To implement a communication protocol, code to handle
+ *      reception of UART data must be added in UART_RXC_ISR, or in
+ *      SYNCH_RECEIVED() in online_synch.h.
+ *
+ * \par Application note:
+ *      AVR054 Synchronization of the internal RC oscillator
+ *
+ ******************************************************************************/
+
+#include "online_synch.h"
+#include "device_specific.h"
+#include "compiler.h"
+
+#if !defined(SYNCH_METHOD_REFERENCE)
+
+extern unsigned char breakDetected;
+extern unsigned char calStep;
+extern unsigned char synchState;
+#if defined(SYNCH_EDGE_PCINT)
+extern unsigned char synchEdgeLevel;
+#endif
+#if defined(SYNCH_TIMEOUT)
+extern unsigned char synchTimeout;
+extern unsigned char lastGoodOSCCAL;
+#endif
+#if defined(SYNCH_TRACE)
+extern unsigned char synchTrace[];
+extern unsigned char synchTraceHead;
+extern unsigned char synchTraceRequest;
+#endif
+#if defined(SYNCH_WAKE_STATS)
+extern unsigned char wakeCounting;
+extern unsigned int wakeTicks;
+extern unsigned int synchWakeToLock;
+#endif
+#if defined(SYNCH_LOCK_RECORD)
+extern unsigned char synchLockEvent;
+#endif
+#if defined(DRIFT_TRACKING)
+extern unsigned int synchCharCount;
+#endif
+#if defined(RESYNCH_REPORT)
+extern unsigned char resynchQuery;
+#endif
+#if defined(SYNCH_VERIFY) & defined(SYNCH_METHOD_SINGLE_SYNCH_BYTE)
+extern unsigned char verifyRetries;
+extern unsigned char verifyCount;
+extern unsigned char verifyFailed;
+#endif
+#if defined(SYNCH_FILTER)
+extern unsigned int glitchCarry;
+#if (SYNCH_SAMPLES > 1)
+extern unsigned char samplesTaken;
+#endif
+#endif
+#if defined(SYNCH_DITHER)
+extern unsigned char ditherDen;
+#endif
+#if defined(SYNCH_METHOD_AUTO_SYNCH_BYTE)
+extern unsigned char synchHeaderBytes;
+extern unsigned char headerOSCCAL;
+extern unsigned char bestOSCCAL;
+#endif
+
+#if defined(SYNCH_METHOD_SINGLE_SYNCH_BYTE) | defined(SYNCH_METHOD_AUTO_SYNCH_BYTE)
+unsigned char defaultOSCCAL;
+#endif
+
+void Initialize_Synchronization(void)
+{
+    // Initialize UART.
+    SYNCH_USART_STATCTRL_REG_B |= (1 << SYNCH_RXEN) | (1 << SYNCH_RXCIE);
+    SYNCH_UBRRH = (SYNCH_UBRR >> 8); //Set baud rate registers
+    SYNCH_UBRRL = (SYNCH_UBRR & 0x00ff);
+#if defined(SYNCH_DOUBLE_SPEED)
+    SYNCH_USART_STATCTRL_REG_A |= (1 << SYNCH_U2X);
+#endif
+
+#if defined(SYNCH_EDGE_PCINT)
+    // The edges are taken from RXD, which is an input while the receiver is
+    // enabled. Only the pin mask is changed from here on.
+    PCINT_CTRL_REGISTER |= (1 << PCINT_ENABLE);
+#else
+    // Set INT0 pin as input, no internal pullup.
+    DDR_INT0 &= ~(1 << PIN_NUMBER_INT0);
+    PORT_INT0 &= ~(1 << PIN_NUMBER_INT0);
+#endif
+
+    // If 8 bit timer is used, it must be started here.
+    #if ! defined(NINE_BIT_TIMER)
+    SYNCH_TIMER_PRESCALER_REGISTER |= (1 << CS00); // Timer/Counter1 runs at fclk. (no prescaling)
+    #endif
+
+    #if defined(SYNCH_TIMEOUT)
+    SYNCH_TIMER_COMPARE_REGISTER = SYNCH_TIMEOUT_COMPARE;
+    lastGoodOSCCAL = OSCCAL;
+    #endif
+
+#if defined(SYNCH_METHOD_SINGLE_SYNCH_BYTE) | defined(SYNCH_METHOD_AUTO_SYNCH_BYTE)
+    // Read default OSCCAL value from EEPROM.
+    while(EECR & (1 << EEPROM_WRITE_ENABLE))
+    { // Wait if EEPROM is busy writing
+    }
+    EEAR = DEFAULT_OSCCAL_ADDRESS;
+    EECR |= (1 << EERE);
+    defaultOSCCAL = EEDR;
+#endif
+}
+
+
+SYNCH_ISR(SYNCH_USART_RXC_vect, UART_RXC_ISR)
+{
+    unsigned char temp;
+    if (SYNCH_USART_STATCTRL_REG_A & (1 << SYNCH_FE))  // Frame error has occured.
+    {
+        PREPARE_FOR_SYNCH();
+    }
+    else
+    {
+        // Process character received by UART receiver.
+        // It is necessary that the UART data register is read at this point
+        // to clear the receive buffer. If the value read is not used, the
+        // compiler will optimize away the reading of UART data register. In
+        // this case the synchronization will not work.
+        temp = SYNCH_UDR;
+#if defined(SYNCH_METHOD_AUTO_SYNCH_BYTE)
+        if (breakDetected)
+        {
+            // First character after the first SYNCH byte of a header. A
+            // second SYNCH byte has been measured by the neighbor search, and
+            // is not passed on. Any other character is data, and the result
+            // of the first SYNCH byte is kept.
+            if (temp == 0x55)
+            {
+                FINISH_HEADER(bestOSCCAL, 2);
+                return;
+            }
+            FINISH_HEADER(headerOSCCAL, 1);
+        }
+#endif
+        SYNCH_RECEIVED(temp);
+#if defined(RESYNCH_REPORT)
+        if (temp == RESYNCH_QUERY + SYNCH_NODE_ID)
+        {
+            resynchQuery = TRUE;        // Answered by Synch_Report_Resynch().
+        }
+#endif
+#if defined(SYNCH_TRACE)
+        if (temp == SYNCH_TRACE_COMMAND)
+        {
+            synchTraceRequest = TRUE;   // Sent by Synch_Trace_Send().
+        }
+#endif
+#if defined(DRIFT_TRACKING)
+        synchCharCount++;
+#endif
+    }
+}
+
+#endif
@@ -12,7 +12,16 @@
  *      increasing by one for each transmission. The last data byte can be used
  *      to confirm that the slave device is able to receive data correctly after
  *      synchronization. The signal is available on the TXD pin of the "master"
- *      device.
+ *      device.\n
+ *      When ADAPTIVE_RESYNCH is defined, the BREAK/SYNCH header is only sent
+ *      when one of the slave nodes is due for a resynchronization. Every
+ *      frame ends with a query to one node, in turn, which answers with the
+ *      number of characters it can receive before its clock leaves tolerance
+ *      (Synch_Report_Resynch() on the slave, built with DRIFT_TRACKING and
+ *      RESYNCH_REPORT). The answer is passed to Set_Resynch_Interval(). The
+ *      TXD pins of the slaves drive the RXD pin of the master, through open
+ *      drain or diode outputs. All other frames consist of the data byte and
+ *      the query only.
  *
  * \par Application note:
  *      AVR054 Synchronization of the internal RC oscillator
@@ -35,11 +44,175 @@
 
 // NUM_SYNCH_BYTES
 // Use 1 for single SYNCH byte synchronization method, 2 for double SYNCH byte.
+// The auto SYNCH byte method takes 1 or 2.
+// The double SYNCH byte method with SYNCH_INTERPOLATE needs 1.
+// The single SYNCH byte method with SYNCH_VERIFY needs 2, and 2 more for each
+// retry of the search. With SYNCH_FILTER, multiply by SYNCH_SAMPLES.
 #define NUM_SYNCH_BYTES       1
 
+// ADAPTIVE_RESYNCH: schedule BREAK/SYNCH headers from the intervals reported
+// by the slave nodes instead of sending one with every frame.
+//#define ADAPTIVE_RESYNCH
 
-#include <ioavr.h>
-#include <inavr.h>
+// Number of slave nodes on the bus.
+#define NUM_NODES             4
+
+// Interval used until a node has reported its own, in characters.
+#define DEFAULT_RESYNCH_INTERVAL  16
+
+// Query for node 0, and the answer when the node has not measured its drift
+// yet. These must match RESYNCH_QUERY and RESYNCH_REPORT_UNKNOWN in
+// online_synch.h of the slave.
+#define RESYNCH_QUERY         0xE0
+#define RESYNCH_REPORT_UNKNOWN    0x3FFF
+
+// Must match SYNCH_TRACE_COMMAND in online_synch.h of the slave.
+#define SYNCH_TRACE_COMMAND   0xC3
+
+// Characters sent per frame after the header: the data byte and the query.
+#define FRAME_CHARS           2
+
+// Polls of the receiver for each byte of an answer, 10 cycles each.
+#define REPLY_TIMEOUT         2000
+
+
+#include "../compiler.h"
+
+// Next byte of the data sweep.
+unsigned char dataByte;
+
+/*! \brief Get the next data byte.
+ *
+ *  The bytes the slaves take as a command are skipped: the queries of all
+ *  16 node IDs and SYNCH_TRACE_COMMAND, and 0x55 directly after a one-byte
+ *  header, which the auto SYNCH byte method takes as a second SYNCH byte.
+ *
+ *  \param oneByteHeader  Nonzero if the byte follows a one-byte header.
+ */
+unsigned char Next_Data(unsigned char oneByteHeader)
+{
+    while (((dataByte & 0xF0) == RESYNCH_QUERY) ||
+           (dataByte == SYNCH_TRACE_COMMAND) ||
+           (oneByteHeader && (dataByte == 0x55)))
+    {
+        dataByte++;
+    }
+    return dataByte++;
+}
+
+#if defined(ADAPTIVE_RESYNCH)
+// Characters each node can receive before it must be resynchronized.
+unsigned int resynchInterval[NUM_NODES];
+// Characters transmitted since the last BREAK/SYNCH header.
+unsigned int charsSinceSynch;
+// Node to query with the next frame.
+unsigned char queryNode;
+
+/*! \brief Store the resynchronization interval reported by a node.
+ *
+ *  \param node      Index of the node.
+ *  \param interval  Characters until the node is out of tolerance.
+ */
+void Set_Resynch_Interval(unsigned char node, unsigned int interval)
+{
+    if (node < NUM_NODES)
+    {
+        __disable_interrupt();
+        resynchInterval[node] = interval;
+        __enable_interrupt();
+    }
+}
+
+/*! \brief Check if a BREAK/SYNCH header must be sent with the next frame.
+ *
+ *  A BREAK resynchronizes every node on the bus, so the header is due as
+ *  soon as the node with the shortest interval would run out of tolerance
+ *  before the end of the next frame.
+ */
+unsigned char Resynch_Due(void)
+{
+    unsigned char i;
+    for (i = 0; i < NUM_NODES; i++)
+    {
+        if ((charsSinceSynch + FRAME_CHARS) >= resynchInterval[i])
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*! \brief Receive one byte of an answer.
+ *
+ *  \return  The byte, or -1 if none has arrived within REPLY_TIMEOUT polls.
+ */
+int Receive_Answer(void)
+{
+    unsigned int t;
+    for (t = 0; t < REPLY_TIMEOUT; t++)
+    {
+        if (UCSRA & (1 << RXC))
+        {
+            return UDR;
+        }
+        __delay_cycles(10);
+    }
+    return -1;
+}
+
+/*! \brief Ask the next node how long it stays within tolerance.
+ *
+ *  Sends the query and waits for the two 7-bit bytes of the answer, low bits
+ *  first. The node counts the characters it has received since its lock,
+ *  which are the characters transmitted here since the header, so the
+ *  answer is added to charsSinceSynch. The interval of a node that does not
+ *  answer, or has not measured its drift yet, is left unchanged.
+ */
+void Query_Node(void)
+{
+    int low;
+    int high;
+    unsigned long interval;
+
+    while ( !( UCSRA & (1<<UDRE)) )
+    {
+
+    }
+    UCSRA = (1 << TXC);             // Cleared by writing 1.
+    UDR = RESYNCH_QUERY + queryNode;
+    charsSinceSynch++;
+    while ( !( UCSRA & (1<<TXC)) )
+    {
+
+    }
+
+    // Discard anything received before the query, and wait for the answer.
+    UCSRB |= (1 << RXEN);
+    while (UCSRA & (1 << RXC))
+    {
+        low = UDR;
+    }
+    low = Receive_Answer();
+    high = (low >= 0) ? Receive_Answer() : -1;
+    UCSRB &= ~(1 << RXEN);
+
+    if ((high >= 0) && (low < 0x80) && (high < 0x80))
+    {
+        interval = ((unsigned int)high << 7) | low;
+        if (interval != RESYNCH_REPORT_UNKNOWN)
+        {
+            interval += charsSinceSynch;
+            Set_Resynch_Interval(queryNode, (interval > 0xFFFF) ?
+                                            0xFFFF : (unsigned int)interval);
+        }
+    }
+
+    if (++queryNode == NUM_NODES)
+    {
+        queryNode = 0;
+    }
+}
+#endif
 
 void main(void)
 {
@@ -52,6 +225,17 @@ void main(void)
     TCCR1B = (1 << CS12) | (0 << CS11) | (1 << CS10);
     TIMSK = (1 << TOIE1);
 
+#if defined(ADAPTIVE_RESYNCH)
+    {
+        unsigned char i;
+        for (i = 0; i < NUM_NODES; i++)
+        {
+            resynchInterval[i] = DEFAULT_RESYNCH_INTERVAL;
+        }
+        charsSinceSynch = DEFAULT_RESYNCH_INTERVAL; // First frame synchs.
+    }
+#endif
+
     __enable_interrupt();
     for (;;)
     {
@@ -60,11 +244,29 @@ void main(void)
 }
 
 
-#pragma vector=TIMER1_OVF_vect
-__interrupt void Generate_signal(void)
+SYNCH_ISR(TIMER1_OVF_vect, Generate_signal)
 {
         unsigned char i;
-        static unsigned char j = 0;
+
+#if defined(ADAPTIVE_RESYNCH)
+        if (!Resynch_Due())
+        {
+            // Transmit the data byte only.
+            UCSRB = (1 << TXEN);
+            while ( !( UCSRA & (1<<UDRE)) )
+            {
+
+            }
+            UDR = Next_Data(0);
+            charsSinceSynch++;
+            Query_Node();
+            UCSRB &= ~(1 << TXEN);
+            PORTD = 0xff;
+            return;
+        }
+        charsSinceSynch = 1;    // The data byte in this frame.
+#endif
+
         //Output long low signal ( > 13 bit times)
         PORTD = 0x00;
         __delay_cycles(30000);
@@ -88,11 +290,15 @@ __interrupt void Generate_signal(void)
         {
 
         }
-        UDR = j++;
+        UDR = Next_Data(NUM_SYNCH_BYTES == 1);
+#if defined(ADAPTIVE_RESYNCH)
+        Query_Node();
+#else
         while ( !( UCSRA & (1<<UDRE)) )
         {
 
         }
+#endif
         // Disable UART
         UCSRB &= ~(1 << TXEN);
 
@@ -0,0 +1,327 @@
+#!/usr/bin/env python3
+"""Size and interrupt timing report for the avr-gcc builds.
+
+Each argument is a build directory made by the Makefile, holding osccal.elf
+and info.txt (tools/report_info.c run through the preprocessor). For every
+build one line is printed with:
+
+  flash     .text + .data, in bytes
+  sram      .data + .bss, in bytes (static allocation only, no stack)
+  ext_int   worst-case cycles of SYNCH_EXT_INT_ISR
+  uart_rxc  worst-case cycles of UART_RXC_ISR
+  delay     cycles between stopping and restarting Timer/Counter0 in
+            SYNCH_EXT_INT_ISR, with COUNTER_READ_DELAY in parentheses, and
+            '!' when the two differ
+
+The interrupt cycle counts include the interrupt response (4 cycles) and the
+jump in the vector table. The longest path through the routine is found on
+its control flow graph, and called functions are included with their own
+worst case. A '+' after a count means that the routine contains a loop or an
+indirect jump, and the count covers one pass only.
+
+The read delay is counted from the instruction that stops the timer (9-bit
+timer) or reads TCNT0 (8-bit timer), to the instruction that starts the
+timer or writes TCNT0, both included, along the path the code takes when
+the branches in between are not taken. COUNTER_READ_DELAY is subtracted
+from every measurement, so a build whose read delay differs from it measures
+the clock wrong: the exit status is 1 if any build does.
+"""
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+
+# Cycles on the classic AVR core with a 16-bit program counter. Branches and
+# skips are handled separately.
+CYCLES = {
+    'adiw': 2, 'sbiw': 2,
+    'mul': 2, 'muls': 2, 'mulsu': 2, 'fmul': 2, 'fmuls': 2, 'fmulsu': 2,
+    'ld': 2, 'ldd': 2, 'st': 2, 'std': 2, 'lds': 2, 'sts': 2,
+    'push': 2, 'pop': 2,
+    'cbi': 2, 'sbi': 2,
+    'lpm': 3, 'elpm': 3, 'spm': 4,
+    'rjmp': 2, 'ijmp': 2, 'jmp': 3,
+    'rcall': 3, 'icall': 3, 'call': 4,
+    'ret': 4, 'reti': 4,
+}
+SKIPS = ('cpse', 'sbrc', 'sbrs', 'sbic', 'sbis')
+RETURNS = ('ret', 'reti')
+INTERRUPT_RESPONSE = 4
+
+LINE_RE = re.compile(r'^\s*([0-9a-f]+):\t([0-9a-f ]+)\t([a-z]+)\s*([^;]*)(?:;\s*(.*))?')
+SYMBOL_RE = re.compile(r'^([0-9a-f]+) <([^>]+)>:')
+
+
+class Function:
+    def __init__(self, name):
+        self.name = name
+        self.code = []      # (address, mnemonic, operands, size, comment)
+
+
+def disassemble(objdump, elf):
+    """Return the functions in the .text section, by name and by address."""
+    out = subprocess.run([objdump, '-d', elf], check=True,
+                         capture_output=True, text=True).stdout
+    return parse_disassembly(out)
+
+
+def parse_disassembly(text):
+    by_name = {}
+    by_address = {}
+    current = None
+    for line in text.splitlines():
+        m = SYMBOL_RE.match(line)
+        if m:
+            current = Function(m.group(2))
+            by_name[current.name] = current
+            by_address[int(m.group(1), 16)] = current
+            continue
+        m = LINE_RE.match(line)
+        if m and current is not None:
+            current.code.append((int(m.group(1), 16), m.group(3),
+                                 m.group(4).strip(), len(m.group(2).split()),
+                                 m.group(5) or ''))
+    return by_name, by_address
+
+
+def target(instruction):
+    """Branch target of a relative or absolute jump. objdump writes the
+    absolute address in the comment after relative jumps."""
+    m = re.search(r'0x([0-9a-f]+)', instruction[4] or instruction[2])
+    if m is None:
+        return None
+    return int(m.group(1), 16)
+
+
+def successors(code, index, by_address):
+    """Return (cost, next index or None, callee) for each way out of an
+    instruction. The index is None when the routine returns."""
+    mnemonic = code[index][1]
+    nxt = index + 1 if index + 1 < len(code) else None
+    if mnemonic in RETURNS:
+        return [(CYCLES[mnemonic], None, None)]
+    if mnemonic.startswith('br') and mnemonic != 'break':
+        dest = find(code, target(code[index]))
+        return [(1, nxt, None), (2, dest, None)]
+    if mnemonic in SKIPS:
+        # The skipped instruction may be one or two words long.
+        skip = nxt + 1 if nxt is not None and nxt + 1 < len(code) else None
+        words = code[nxt][3] // 2 if nxt is not None else 1
+        return [(1, nxt, None), (1 + words, skip, None)]
+    if mnemonic in ('rjmp', 'jmp'):
+        dest = find(code, target(code[index]))
+        if dest is None:
+            # Tail call to another function.
+            return [(CYCLES[mnemonic], None,
+                     by_address.get(target(code[index])))]
+        return [(CYCLES[mnemonic], dest, None)]
+    if mnemonic in ('rcall', 'call'):
+        return [(CYCLES[mnemonic], nxt, by_address.get(target(code[index])))]
+    if mnemonic in ('ijmp', 'icall'):
+        return [(CYCLES[mnemonic], None, 'indirect')]
+    return [(CYCLES.get(mnemonic, 1), nxt, None)]
+
+
+def find(code, address):
+    for i, instruction in enumerate(code):
+        if instruction[0] == address:
+            return i
+    return None
+
+
+def worst_case(function, by_address, cache=None, active=None):
+    """Longest path through a function, in cycles. Returns (cycles, exact)."""
+    if cache is None:
+        cache = {}
+    if active is None:
+        active = set()
+    if function.name in cache:
+        return cache[function.name]
+    if function.name in active:
+        return 0, False      # Recursion
+    active.add(function.name)
+
+    code = function.code
+    memo = {}
+    exact = [True]
+
+    def longest(index, path):
+        if index is None:
+            return 0
+        if index in path:
+            exact[0] = False      # Loop; count one pass.
+            return 0
+        if index in memo:
+            return memo[index]
+        path.add(index)
+        best = 0
+        for cost, nxt, callee in successors(code, index, by_address):
+            extra = 0
+            if callee == 'indirect':
+                exact[0] = False
+            elif callee is not None:
+                extra, callee_exact = worst_case(callee, by_address,
+                                                 cache, active)
+                exact[0] &= callee_exact
+            best = max(best, cost + extra + longest(nxt, path))
+        path.discard(index)
+        memo[index] = best
+        return best
+
+    result = (longest(0, set()) if code else 0, exact[0])
+    active.discard(function.name)
+    cache[function.name] = result
+    return result
+
+
+def writes(instruction, address):
+    mnemonic, operands = instruction[1], instruction[2]
+    dest = operands.split(',')[0].strip()
+    if mnemonic == 'out':
+        return int(dest, 0) + 0x20 == address
+    if mnemonic == 'sts':
+        return int(dest, 0) == address
+    return False
+
+
+def reads(instruction, address):
+    mnemonic, operands = instruction[1], instruction[2]
+    src = operands.split(',')[-1].strip()
+    if mnemonic == 'in':
+        return int(src, 0) + 0x20 == address
+    if mnemonic == 'lds':
+        return int(src, 0) == address
+    return False
+
+
+def read_delay(function, info):
+    """Cycles from stopping to restarting Timer/Counter0, or None."""
+    code = function.code
+    if info['timer_bits'] == 9:
+        start = next((i for i, c in enumerate(code)
+                      if writes(c, info['TIMER_PRESCALER'])), None)
+        is_end = lambda c: writes(c, info['TIMER_PRESCALER'])
+    else:
+        start = next((i for i, c in enumerate(code)
+                      if reads(c, info['TIMER_COUNT'])), None)
+        is_end = lambda c: writes(c, info['TIMER_COUNT'])
+    if start is None:
+        return None
+    cycles = CYCLES.get(code[start][1], 1)
+    for instruction in code[start + 1:]:
+        mnemonic = instruction[1]
+        if mnemonic.startswith('br') or mnemonic in SKIPS:
+            cycles += 1
+        else:
+            cycles += CYCLES.get(mnemonic, 1)
+        if is_end(instruction):
+            return cycles
+    return None
+
+
+def read_info(path):
+    """Parse info.txt, written by the preprocessor from report_info.c."""
+    info = {'vectors': {}}
+    with open(path) as f:
+        for line in f:
+            words = line.split(None, 2)
+            if not words:
+                continue
+            if words[0] == 'REPORT_VECTOR' and len(words) == 3:
+                info['vectors'][words[1]] = words[2].strip()
+            elif words[0] == 'REPORT_SFR':
+                info[words[1]] = sfr_address(words[2])
+            elif words[0] == 'REPORT_TIMER_BITS':
+                info['timer_bits'] = int(words[1])
+            elif words[0] == 'REPORT_READ_DELAY':
+                info['read_delay'] = int(words[1])
+    return info
+
+
+def sfr_address(text):
+    """Data space address from the expansion of an avr-libc SFR macro, for
+    example (*(volatile uint8_t *)((0x32) + 0x20))."""
+    m = re.search(r'\*\s*\)\s*(\(.*\))\s*\)', text)
+    expression = m.group(1) if m else text
+    if not re.fullmatch(r'[\s0-9a-fA-Fx()+]+', expression):
+        raise ValueError('cannot parse SFR address: ' + text)
+    return eval(expression)
+
+
+def section_sizes(size, elf):
+    out = subprocess.run([size, '-A', elf], check=True,
+                         capture_output=True, text=True).stdout
+    sizes = {}
+    for line in out.splitlines():
+        words = line.split()
+        if len(words) >= 2 and words[0].startswith('.'):
+            sizes[words[0]] = int(words[1])
+    return sizes
+
+
+def vector_jump(by_name):
+    vectors = by_name.get('__vectors')
+    if vectors is None or not vectors.code:
+        return 2
+    return CYCLES.get(vectors.code[0][1], 2)
+
+
+def isr_cycles(name, info, by_name, by_address):
+    symbol = info['vectors'].get(name)
+    function = by_name.get(symbol)
+    if function is None:
+        return '-'
+    cycles, exact = worst_case(function, by_address)
+    cycles += INTERRUPT_RESPONSE + vector_jump(by_name)
+    return str(cycles) + ('' if exact else '+')
+
+
+def report(directory, args):
+    elf = os.path.join(directory, 'osccal.elf')
+    info = read_info(os.path.join(directory, 'info.txt'))
+    sizes = section_sizes(args.size, elf)
+    by_name, by_address = disassemble(args.objdump, elf)
+
+    flash = sizes.get('.text', 0) + sizes.get('.data', 0)
+    sram = sizes.get('.data', 0) + sizes.get('.bss', 0)
+    ext_int = isr_cycles('SYNCH_EXT_INT_ISR', info, by_name, by_address)
+    uart_rxc = isr_cycles('UART_RXC_ISR', info, by_name, by_address)
+
+    delay = '-'
+    mismatch = False
+    function = by_name.get(info['vectors'].get('SYNCH_EXT_INT_ISR'))
+    if function is not None:
+        measured = read_delay(function, info)
+        if measured is not None:
+            mismatch = measured != info['read_delay']
+            delay = '%d (%d)%s' % (measured, info['read_delay'],
+                                   '!' if mismatch else '')
+
+    return (os.path.basename(os.path.normpath(directory)), flash, sram,
+            ext_int, uart_rxc, delay), mismatch
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--objdump', default='avr-objdump')
+    parser.add_argument('--size', default='avr-size')
+    parser.add_argument('builds', nargs='+')
+    args = parser.parse_args()
+
+    row = '%-26s %6s %5s %8s %9s %10s'
+    print(row % ('build', 'flash', 'sram', 'ext_int', 'uart_rxc', 'delay'))
+    status = 0
+    for directory in args.builds:
+        line, mismatch = report(directory, args)
+        print(row % line)
+        if mismatch:
+            print('%s: read delay differs from COUNTER_READ_DELAY in '
+                  'device_specific.h' % line[0], file=sys.stderr)
+            status = 1
+    return status
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,432 @@
+/* This file has been prepared for Doxygen automatic documentation generation.*/
+/*! \file *********************************************************************
+ *
+ * \brief
+ *      Simulates a bus with one master and many slaves.
+ *
+ *      The master sends frames in the format of test_node/test.c: a BREAK,
+ *      the SYNCH bytes and the payload bytes. Each slave is an engine (see
+ *      engine.c) running the synchronization code, with its own oscillator:
+ *      a random initial error, a random linear drift and a random spread of
+ *      the OSCCAL step size, from a seeded generator so that runs repeat.
+ *
+ *      The BREAK/SYNCH header is sent with every frame, with every K-th
+ *      frame, or adaptively as in test.c with ADAPTIVE_RESYNCH: each slave
+ *      reports Synch_Time_To_Resynch() after every frame, and a header is
+ *      sent when the slave with the shortest interval would run out of
+ *      tolerance. The adaptive policy needs DRIFT_TRACKING in the slave
+ *      build; without it every slave keeps the default interval.
+ *
+ *      The edges of a frame are built once and every slave is run over the
+ *      whole frame before the next slave, which keeps the switching of the
+ *      firmware state between slaves to once per slave and frame.
+ *
+ *      The summary gives the payload throughput of the bus, the share of the
+ *      bus time taken by headers, the byte and frame error rates over all
+ *      slaves, and the resynchronization counts. The exit status is 1 if a
+ *      payload byte was lost or received with a wrong value, or if more
+ *      than the share of the frames given with -x had a header.
+ *
+ * \par Application note:
+ *      AVR054 Synchronization of the internal RC oscillator
+ *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../../compiler.h"
+#include "../../online_synch.h"
+#include "engine.h"
+
+// BREAK and delimiter as sent by test.c at 8 MHz.
+#define BREAK_TIME          (30000 / 8e6)
+#define DELIMITER_TIME      (1000 / 8e6)
+
+// Interval used until a slave has reported its own, in characters.
+#define DEFAULT_RESYNCH_INTERVAL  16
+
+#if defined(SYNCH_INTERPOLATE)
+#define DEFAULT_SYNCH_BYTES 1
+#elif defined(SYNCH_METHOD_DOUBLE_SYNCH_BYTE) | defined(SYNCH_VERIFY)
+#define DEFAULT_SYNCH_BYTES 2
+#else
+#define DEFAULT_SYNCH_BYTES 1
+#endif
+
+struct slave
+{
+    struct engine engine;
+    double error;           // Oscillator error at time 0.
+    double drift;           // Change of the error per second.
+    unsigned int interval;  // Reported resynchronization interval.
+
+    int nextByte;           // Next expected payload byte of the frame.
+    long good;
+    long bad;
+    long frameErrors;
+    long failedFrames;      // Frames without all payload bytes received.
+    long locks;
+};
+
+// Settings.
+static int numSlaves = 100;
+static long numFrames = 1000;
+static int payload = 1;
+static int synchBytes = DEFAULT_SYNCH_BYTES;
+static int every = 1;           // Header every K frames, 0 for adaptive.
+static double errorSpread = 0.10;
+static double driftSpread = 200e-6;
+static double stepBase = 0.007;
+static double stepSpread = 0.10;
+static double masterError;
+static double gap = 2e-3;
+static double maxHeaders = 1.0;
+static unsigned long seed = 1;
+
+// Payload bytes of the current frame.
+static unsigned char *frameBytes;
+// End of the BREAK of the current frame. The BREAK is a frame error by
+// design, and is not counted.
+static double breakEnd;
+
+
+/*! \brief Uniform random number in [-1, 1), xorshift32. */
+static double Random(void)
+{
+    seed ^= (seed << 13) & 0xFFFFFFFFUL;
+    seed ^= seed >> 17;
+    seed ^= (seed << 5) & 0xFFFFFFFFUL;
+    return (double)seed / 2147483648.0 - 1.0;
+}
+
+static void Report(struct engine *e, int event, int value)
+{
+    struct slave *s = e->user;
+    int i;
+
+    switch (event)
+    {
+        case ENGINE_RX:
+            // Lost bytes are skipped, anything else is a bad byte.
+            for (i = s->nextByte; i < payload; i++)
+            {
+                if (frameBytes[i] == value)
+                {
+                    break;
+                }
+            }
+            if (i < payload)
+            {
+                s->good++;
+                s->nextByte = i + 1;
+            }
+            else
+            {
+                s->bad++;
+            }
+            break;
+        case ENGINE_FRAME_ERROR:
+            if (e->now > breakEnd)
+            {
+                s->frameErrors++;
+            }
+            break;
+        case ENGINE_LOCK:
+            s->locks++;
+            break;
+    }
+}
+
+
+// Edges of one frame.
+static struct edge *edges;
+static int numEdges;
+
+static void Add_Edge(double time, int level)
+{
+    edges[numEdges].time = time;
+    edges[numEdges].level = level;
+    numEdges++;
+}
+
+static double Add_Char(double t, double bit, int value)
+{
+    int level = 1;
+    int b;
+    int i;
+
+    // Start bit, data bits LSB first, stop bit.
+    for (i = 0; i < 10; i++)
+    {
+        b = (i == 0) ? 0 : (i == 9) ? 1 : (value >> (i - 1)) & 1;
+        if (b != level)
+        {
+            Add_Edge(t + i * bit, b);
+            level = b;
+        }
+    }
+    return t + 10 * bit;
+}
+
+/*! \brief Build the edges of the frame starting at t, return its end. */
+static double Build_Frame(double t, int header, long frame)
+{
+    double bit = 1.0 / (SYNCH_FREQUENCY * (1.0 + masterError));
+    int i;
+
+    numEdges = 0;
+    breakEnd = 0;
+    if (header)
+    {
+        Add_Edge(t, 0);
+        t += BREAK_TIME;
+        breakEnd = t;
+        Add_Edge(t, 1);
+        t += DELIMITER_TIME;
+        for (i = 0; i < synchBytes; i++)
+        {
+            t = Add_Char(t, bit, 0x55);
+        }
+    }
+    for (i = 0; i < payload; i++)
+    {
+        frameBytes[i] = (0xA5 + frame + i) & 0xFF;
+        if (header && (synchBytes == 1) && (i == 0) &&
+            (frameBytes[i] == 0x55))
+        {
+            // Taken as a second SYNCH byte by the auto synch byte method.
+            frameBytes[i] = 0xAA;
+        }
+        t = Add_Char(t, bit, frameBytes[i]);
+    }
+    return t;
+}
+
+
+static void Usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -n slaves      number of slaves (100)\n"
+            "  -f frames      number of frames (1000)\n"
+            "  -p bytes       payload bytes per frame (1)\n"
+            "  -b bytes       SYNCH bytes per header (%d)\n"
+            "  -k frames      header every k frames, 0 for adaptive (1)\n"
+            "  -e percent     spread of the initial oscillator error (10)\n"
+            "  -d ppm         spread of the drift, per second (200)\n"
+            "  -s permille    frequency change per OSCCAL step (7)\n"
+            "  -v percent     spread of the OSCCAL step between slaves (10)\n"
+            "  -m ppm         master clock error (0)\n"
+            "  -g ms          idle time between frames (2)\n"
+            "  -r seed        random seed (1)\n"
+            "  -x percent     fail if more frames have a header (100)\n",
+            name, DEFAULT_SYNCH_BYTES);
+}
+
+int main(int argc, char *argv[])
+{
+    struct slave *slaves;
+    struct slave *s;
+    unsigned int charsSinceSynch = DEFAULT_RESYNCH_INTERVAL;
+    unsigned int remaining;
+    long headers = 0;
+    long frame;
+    long good = 0;
+    long bad = 0;
+    long frameErrors = 0;
+    long failedFrames = 0;
+    long locks = 0;
+    long before;
+    long sent;
+    long minLocks = 0x7FFFFFFFL;
+    long maxLocks = 0;
+    int header;
+    int i;
+    double t;
+    double end;
+    double headerTime = 0;
+    clock_t start;
+
+    for (i = 1; i < argc; i++)
+    {
+        if ((argv[i][0] != '-') || !argv[i][1] || (i + 1 >= argc))
+        {
+            Usage(argv[0]);
+            return 2;
+        }
+        switch (argv[i][1])
+        {
+            case 'n': numSlaves = atoi(argv[++i]); break;
+            case 'f': numFrames = atol(argv[++i]); break;
+            case 'p': payload = atoi(argv[++i]); break;
+            case 'b': synchBytes = atoi(argv[++i]); break;
+            case 'k': every = atoi(argv[++i]); break;
+            case 'e': errorSpread = atof(argv[++i]) / 100.0; break;
+            case 'd': driftSpread = atof(argv[++i]) / 1e6; break;
+            case 's': stepBase = atof(argv[++i]) / 1000.0; break;
+            case 'v': stepSpread = atof(argv[++i]) / 100.0; break;
+            case 'm': masterError = atof(argv[++i]) / 1e6; break;
+            case 'g': gap = atof(argv[++i]) / 1000.0; break;
+            case 'r': seed = strtoul(argv[++i], NULL, 0); break;
+            case 'x': maxHeaders = atof(argv[++i]) / 100.0; break;
+            default: Usage(argv[0]); return 2;
+        }
+    }
+    if ((numSlaves < 1) || (numFrames < 1) || (payload < 1) ||
+        (synchBytes < 1) || (every < 0) || (seed == 0))
+    {
+        Usage(argv[0]);
+        return 2;
+    }
+
+    slaves = calloc(numSlaves, sizeof(*slaves));
+    frameBytes = malloc(payload);
+    edges = malloc((synchBytes + payload) * 10 * sizeof(*edges) +
+                   2 * sizeof(*edges));
+    if ((slaves == NULL) || (frameBytes == NULL) || (edges == NULL))
+    {
+        perror(argv[0]);
+        return 2;
+    }
+    for (i = 0; i < numSlaves; i++)
+    {
+        s = &slaves[i];
+        s->error = errorSpread * Random();
+        s->drift = driftSpread * Random();
+        s->interval = DEFAULT_RESYNCH_INTERVAL;
+        Engine_Init(&s->engine, s->error, stepBase * (1.0 + stepSpread *
+                    Random()), 64);
+        s->engine.report = Report;
+        s->engine.user = s;
+    }
+
+    printf("# %d slaves, %ld frames, %d payload bytes, %s, %d-bit timer\n",
+           numSlaves, numFrames, payload,
+#if defined(SYNCH_METHOD_DOUBLE_SYNCH_BYTE)
+           "double synch byte",
+#elif defined(SYNCH_METHOD_AUTO_SYNCH_BYTE)
+           "auto synch byte",
+#else
+           "single synch byte",
+#endif
+#if defined(NINE_BIT_TIMER)
+           9
+#else
+           8
+#endif
+           );
+    if (every)
+    {
+        printf("# header every %d frames\n", every);
+    }
+    else
+    {
+        printf("# adaptive headers%s\n",
+#if defined(DRIFT_TRACKING)
+               ""
+#else
+               ", without DRIFT_TRACKING"
+#endif
+               );
+    }
+
+    t = gap;
+    start = clock();
+    for (frame = 0; frame < numFrames; frame++)
+    {
+        if (every)
+        {
+            header = (frame % every) == 0;
+        }
+        else
+        {
+            // As Resynch_Due() in test.c.
+            header = 0;
+            for (i = 0; i < numSlaves; i++)
+            {
+                if ((charsSinceSynch + payload) >= slaves[i].interval)
+                {
+                    header = 1;
+                }
+            }
+        }
+        if (header)
+        {
+            headers++;
+            charsSinceSynch = 0;
+            headerTime += BREAK_TIME + DELIMITER_TIME +
+                          synchBytes * 10.0 /
+                          (SYNCH_FREQUENCY * (1.0 + masterError));
+        }
+        charsSinceSynch += payload;
+
+        end = Build_Frame(t, header, frame);
+        for (i = 0; i < numSlaves; i++)
+        {
+            s = &slaves[i];
+            s->engine.error = s->error + s->drift * t;
+            s->nextByte = 0;
+            before = s->good;
+            Engine_Run(&s->engine, edges, numEdges, 1, end + gap);
+            if (s->good - before < payload)
+            {
+                s->failedFrames++;
+            }
+
+            // The slave reports the characters left until it is out of
+            // tolerance. The interval is kept from the last header.
+            remaining = Engine_Main_Loop(&s->engine);
+            if (remaining != 0xFFFF)
+            {
+                s->interval = charsSinceSynch + remaining;
+            }
+        }
+        t = end + gap;
+    }
+
+    for (i = 0; i < numSlaves; i++)
+    {
+        s = &slaves[i];
+        good += s->good;
+        bad += s->bad;
+        frameErrors += s->frameErrors;
+        failedFrames += s->failedFrames;
+        locks += s->locks;
+        if (s->locks < minLocks)
+        {
+            minLocks = s->locks;
+        }
+        if (s->locks > maxLocks)
+        {
+            maxLocks = s->locks;
+        }
+        Engine_Free(&s->engine);
+    }
+
+    sent = numFrames * payload;
+    printf("# bus time %.3f s, headers %ld, header share %.1f %%\n",
+           t, headers, headerTime / t * 100.0);
+    printf("# payload %.1f bytes/s sent, %.1f bytes/s received per slave\n",
+           sent / t, good / (t * numSlaves));
+    printf("# bytes lost %.3f %%, bad %.3f %%, frame errors %.3f %% "
+           "of the bytes sent\n",
+           (double)(sent * numSlaves - good) / (sent * numSlaves) * 100.0,
+           (double)bad / (sent * numSlaves) * 100.0,
+           (double)frameErrors / (sent * numSlaves) * 100.0);
+    printf("# failed frames %.3f %%\n",
+           (double)failedFrames / ((double)numFrames * numSlaves) * 100.0);
+    printf("# resynchronizations %ld, per slave %.1f (min %ld, max %ld)\n",
+           locks, (double)locks / numSlaves, minLocks, maxLocks);
+    fprintf(stderr, "%s: %ld slave frames in %.3f s\n", argv[0],
+            numFrames * numSlaves,
+            (double)(clock() - start) / CLOCKS_PER_SEC);
+
+    free(edges);
+    free(frameBytes);
+    free(slaves);
+    return ((good != sent * numSlaves) || (bad != 0) ||
+            (headers > maxHeaders * numFrames)) ? 1 : 0;
+}
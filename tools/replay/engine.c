@@ -0,0 +1,468 @@
+/* This file has been prepared for Doxygen automatic documentation generation.*/
+/*! \file *********************************************************************
+ *
+ * \brief
+ *      Host model of one slave running the synchronization code.
+ *
+ *      The synchronization source code is included here, built with
+ *      SYNCH_HOST defined, so that its file scope variables can be saved and
+ *      restored for each engine. The variables are listed in FIRMWARE_STATE
+ *      and must be kept in step with the source code. Static variables
+ *      inside the interrupt service routines are not switched: they only
+ *      hold state within one synchronization, and Engine_Run() always
+ *      completes the synchronization of one slave before it runs the next.
+ *
+ *      The edges on the bus are converted to CPU cycles of the slave with
+ *      the oscillator model in struct engine, so the time base follows
+ *      every change of OSCCAL made by the code. Each edge that matches the
+ *      INT0 sense control calls SYNCH_EXT_INT_ISR with TCNT0 and TOV0 set to
+ *      the cycles counted since the last call, less COUNTER_READ_DELAY. The
+ *      UART receiver samples the bit centers at the slave baud rate, and
+ *      calls UART_RXC_ISR at the stop bit with UDR and FE set.
+ *
+ *      The interrupt service routines run in zero time, so edges closer
+ *      together than the execution time of SYNCH_EXT_INT_ISR are all seen,
+ *      which the device would not do. The timeout interrupt is not modelled.
+ *
+ * \par Application note:
+ *      AVR054 Synchronization of the internal RC oscillator
+ *
+ ******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#define main  Firmware_Main
+#define sleep Firmware_Sleep
+#include "../../main.c"
+#undef main
+#undef sleep
+#include "../../synch_status.c"
+#include "../../synch_uart.c"
+#if defined(SYNCH_METHOD_DOUBLE_SYNCH_BYTE)
+#include "../../double_synch_byte.c"
+#elif defined(SYNCH_METHOD_AUTO_SYNCH_BYTE)
+#include "../../auto_synch_byte.c"
+#else
+#include "../../single_synch_byte.c"
+#endif
+
+#include "engine.h"
+
+volatile unsigned char hostIO[0x60];
+
+// File scope variables of the synchronization code, by feature.
+#if defined(SYNCH_TIMEOUT)
+#define TIMEOUT_STATE(X) X(synchTimeout) X(lastGoodOSCCAL)
+#else
+#define TIMEOUT_STATE(X)
+#endif
+
+#if defined(SYNCH_WAKE_STATS)
+#define WAKE_STATE(X) X(wakeCounting) X(wakeTicks) X(synchWakeToLock)
+#else
+#define WAKE_STATE(X)
+#endif
+
+#if defined(SYNCH_LOCK_RECORD)
+#define LOCK_STATE(X) X(synchLockEvent) X(synchLockOSCCAL) X(synchLockError)
+#else
+#define LOCK_STATE(X)
+#endif
+
+#if defined(DRIFT_TRACKING) & defined(RESYNCH_REPORT)
+#define DRIFT_STATE(X) X(synchCharCount) X(refLockOSCCAL) X(refLockError) \
+                       X(refLockChars) X(refLockValid) X(resynchChars) X(resynchQuery)
+#elif defined(DRIFT_TRACKING)
+#define DRIFT_STATE(X) X(synchCharCount) X(refLockOSCCAL) X(refLockError) \
+                       X(refLockChars) X(refLockValid) X(resynchChars)
+#else
+#define DRIFT_STATE(X)
+#endif
+
+#if defined(SYNCH_VERIFY) & defined(SYNCH_METHOD_SINGLE_SYNCH_BYTE)
+#define VERIFY_STATE(X) X(verifyRetries) X(verifyCount) X(verifyFailed)
+#else
+#define VERIFY_STATE(X)
+#endif
+
+#if defined(SYNCH_FILTER) & (SYNCH_SAMPLES > 1)
+#define FILTER_STATE(X) X(glitchCarry) X(samplesTaken) X(sampleSum) \
+                        X(sampleMin) X(sampleMax)
+#elif defined(SYNCH_FILTER)
+#define FILTER_STATE(X) X(glitchCarry)
+#else
+#define FILTER_STATE(X)
+#endif
+
+#if defined(SYNCH_TRACE)
+#define TRACE_STATE(X) X(synchTrace) X(synchTraceHead) X(synchTraceRequest)
+#else
+#define TRACE_STATE(X)
+#endif
+
+#if defined(SYNCH_METHOD_SINGLE_SYNCH_BYTE)
+#define METHOD_STATE(X) X(defaultOSCCAL)
+#elif defined(SYNCH_METHOD_AUTO_SYNCH_BYTE)
+#define METHOD_STATE(X) X(defaultOSCCAL) X(synchHeaderBytes) X(headerOSCCAL) \
+                        X(bestOSCCAL)
+#elif defined(SYNCH_DITHER)
+#define METHOD_STATE(X) X(ditherLowOSCCAL) X(ditherHighOSCCAL) X(ditherNum) \
+                        X(ditherDen) X(ditherAcc)
+#else
+#define METHOD_STATE(X)
+#endif
+
+#define FIRMWARE_STATE(X) \
+X(hostIO) X(breakDetected) X(synchState) X(calStep) \
+TIMEOUT_STATE(X) WAKE_STATE(X) LOCK_STATE(X) DRIFT_STATE(X) \
+VERIFY_STATE(X) FILTER_STATE(X) TRACE_STATE(X) METHOD_STATE(X)
+
+#define STATE_FIELD(var) __typeof__(var) var;
+#define STATE_SAVE(var) memcpy((void *)&s->var, (void *)&var, sizeof(var));
+#define STATE_LOAD(var) memcpy((void *)&var, (void *)&s->var, sizeof(var));
+
+struct firmware_state
+{
+    FIRMWARE_STATE(STATE_FIELD)
+};
+
+// Engine whose state is in the firmware variables.
+static struct engine *current;
+// Firmware variables after reset, with their initializers.
+static struct firmware_state initial;
+static int initialSaved;
+
+static void Enter(struct engine *e)
+{
+    struct firmware_state *s;
+
+    if (current == e)
+    {
+        return;
+    }
+    if (current != NULL)
+    {
+        s = current->firmware;
+        FIRMWARE_STATE(STATE_SAVE)
+    }
+    s = e->firmware;
+    FIRMWARE_STATE(STATE_LOAD)
+    current = e;
+}
+
+static double Frequency(struct engine *e)
+{
+    return NOMINAL_FREQUENCY * (1.0 + e->error) *
+           (1.0 + e->step * ((int)OSCCAL - e->factory));
+}
+
+static void Advance(struct engine *e, double time)
+{
+    e->cycles += (time - e->now) * Frequency(e);
+    e->now = time;
+}
+
+static void Report(struct engine *e, int event, int value)
+{
+    if (e->report != NULL)
+    {
+        e->report(e, event, value);
+    }
+}
+
+/*! \brief Line level at a given time, by binary search in the edges. */
+static int Line_Level(const struct edge *edges, int numEdges,
+                      int initialLevel, double time)
+{
+    int low = 0;
+    int high = numEdges;
+    int mid;
+
+    while (low < high)
+    {
+        mid = (low + high) / 2;
+        if (edges[mid].time <= time)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low ? edges[low - 1].level : initialLevel;
+}
+
+/*! \brief Call SYNCH_EXT_INT_ISR with the Timer/Counter0 state. */
+static void External_Interrupt(struct engine *e)
+{
+    long count = 0;
+
+    if (TCCR0B & ((1 << CS02) | (1 << CS01) | (1 << CS00)))
+    {
+        count = (long)(e->cycles - e->timerStart);
+        if (count < 0)
+        {
+            count = 0;
+        }
+    }
+    TCNT0 = count & 0xFF;
+    if (count > 0xFF)
+    {
+        TIFR |= (1 << TOV0);
+    }
+
+    SYNCH_EXT_INT_ISR();
+
+    // Every path through the routine resets the timer, and the flag
+    // registers are cleared by writing one.
+    e->timerStart = e->cycles + COUNTER_READ_DELAY;
+    TIFR &= ~(1 << TOV0);
+    EIFR &= ~(1 << INTF0);
+
+    Report(e, ENGINE_INT0, (count > 0x1FF) ? 0x1FF : (int)count);
+}
+
+/*! \brief Check the INT0 sense control for an edge to the given level. */
+static int Int0_Triggers(int level)
+{
+    if (!(GIMSK & (1 << INT0)))
+    {
+        return 0;
+    }
+    switch (MCUCR & ((1 << ISC01) | (1 << ISC00)))
+    {
+        case 0:                 return !level;  // Low level
+        case (1 << ISC00):      return 1;       // Any change
+        case (1 << ISC01):      return !level;  // Falling edge
+        default:                return level;   // Rising edge
+    }
+}
+
+static void Receive_Complete(struct engine *e)
+{
+    int header = 0;
+
+    e->rxBusy = 0;
+    if (!(UCSRB & (1 << RXEN)))
+    {
+        return;
+    }
+    if (e->rxValue < 0)
+    {
+        UCSRA |= (1 << FE);
+        UDR = 0;
+    }
+    else
+    {
+        UCSRA &= ~(1 << FE);
+        UDR = e->rxValue;
+    }
+    if (UCSRB & (1 << RXCIE))
+    {
+#if defined(SYNCH_METHOD_AUTO_SYNCH_BYTE)
+        // A second SYNCH byte ends the synchronization, and is not passed on.
+        header = breakDetected;
+        UART_RXC_ISR();
+        header = header && (synchHeaderBytes == 2);
+#else
+        UART_RXC_ISR();
+#endif
+    }
+    // Reported after the interrupt, like ENGINE_INT0.
+    if (e->rxValue < 0)
+    {
+        Report(e, ENGINE_FRAME_ERROR, 0);
+    }
+    else if (!header)
+    {
+        Report(e, ENGINE_RX, e->rxValue);
+    }
+}
+
+/*! \brief Initialize an engine and run Initialize_Synchronization().
+ *
+ *  The factory value is in OSCCAL after reset, and in EEPROM for the single
+ *  synch byte method.
+ */
+void Engine_Init(struct engine *e, double error, double step, int factory)
+{
+    memset(e, 0, sizeof(*e));
+    e->error = error;
+    e->step = step;
+    e->factory = factory;
+    e->firmware = malloc(sizeof(struct firmware_state));
+    if (e->firmware == NULL)
+    {
+        abort();
+    }
+    if (!initialSaved)
+    {
+        // No engine has run yet.
+        struct firmware_state *s = &initial;
+        FIRMWARE_STATE(STATE_SAVE)
+        initialSaved = 1;
+    }
+    *e->firmware = initial;
+    Enter(e);
+    OSCCAL = factory;
+    EEDR = factory;
+    Initialize_Synchronization();
+    e->calibrating = breakDetected;
+}
+
+void Engine_Free(struct engine *e)
+{
+    if (current == e)
+    {
+        current = NULL;
+    }
+    free(e->firmware);
+    e->firmware = NULL;
+}
+
+/*! \brief Run the slave on the bus up to a given time.
+ *
+ *  \param edges         Level changes on the bus, from the current time of
+ *                       the engine. The level before the first is
+ *                       initialLevel. Characters are sampled from these
+ *                       edges, so they must cover the characters that start
+ *                       before until.
+ *  \param until         Time to stop, in seconds.
+ */
+void Engine_Run(struct engine *e, const struct edge *edges, int numEdges,
+                int initialLevel, double until)
+{
+    int next = 0;
+    int level;
+    double bit;
+    double pendingTime;
+    int b;
+
+    Enter(e);
+    while (1)
+    {
+        pendingTime = e->now;
+        if (e->int0Pending)
+        {
+            pendingTime += (e->timerStart - e->cycles) / Frequency(e);
+        }
+        if (e->int0Pending && (pendingTime <= until) &&
+            ((next >= numEdges) || (pendingTime <= edges[next].time)) &&
+            (!e->rxBusy || (pendingTime <= e->rxTime)))
+        {
+            // Edges latched while the routine ran give one more interrupt.
+            Advance(e, pendingTime);
+            e->int0Pending = 0;
+            if (GIMSK & (1 << INT0))
+            {
+                External_Interrupt(e);
+            }
+        }
+        else if (e->rxBusy && (e->rxTime <= until) &&
+            ((next >= numEdges) || (e->rxTime <= edges[next].time)))
+        {
+            // Stop bit of the character being received.
+            Advance(e, e->rxTime);
+            Receive_Complete(e);
+        }
+        else if ((next < numEdges) && (edges[next].time <= until))
+        {
+            Advance(e, edges[next].time);
+            level = edges[next].level;
+            next++;
+
+            bit = ((UCSRA & (1 << U2X)) ? 8.0 : 16.0) *
+                  (((UBRRH << 8) | UBRRL) + 1) / Frequency(e);
+            if (!level && !e->rxBusy && (UCSRB & (1 << RXEN)) &&
+                !Line_Level(edges, numEdges, initialLevel,
+                            e->now + 0.5 * bit))
+            {
+                // Start bit, still low at its center: the receiver ignores
+                // a shorter pulse. Sample the bit centers at the slave baud
+                // rate.
+                e->rxValue = 0;
+                for (b = 0; b < 8; b++)
+                {
+                    e->rxValue |= Line_Level(edges, numEdges, initialLevel,
+                                             e->now + (b + 1.5) * bit) << b;
+                }
+                if (!Line_Level(edges, numEdges, initialLevel,
+                                e->now + 9.5 * bit))
+                {
+                    e->rxValue = -1;
+                }
+                e->rxTime = e->now + 9.5 * bit;
+                e->rxBusy = 1;
+            }
+            if (Int0_Triggers(level))
+            {
+                if (e->cycles < e->timerStart)
+                {
+                    // SYNCH_EXT_INT_ISR has not yet restarted the timer.
+                    e->int0Pending = 1;
+                }
+                else
+                {
+                    External_Interrupt(e);
+                }
+            }
+        }
+        else
+        {
+            break;
+        }
+
+        if (!breakDetected && e->calibrating)
+        {
+            Report(e, ENGINE_LOCK, OSCCAL);
+        }
+        e->calibrating = breakDetected;
+    }
+    Advance(e, until);
+}
+
+/*! \brief Run the work of the main loop.
+ *
+ *  \return  Synch_Time_To_Resynch() with DRIFT_TRACKING, otherwise 0xFFFF.
+ */
+unsigned int Engine_Main_Loop(struct engine *e)
+{
+    Enter(e);
+#if defined(DRIFT_TRACKING)
+    Synch_Update_Drift();
+    return Synch_Time_To_Resynch();
+#else
+    return 0xFFFF;
+#endif
+}
+
+unsigned char Engine_OSCCAL(struct engine *e)
+{
+    Enter(e);
+    return OSCCAL;
+}
+
+#if defined(SYNCH_TRACE)
+/*! \brief Copy the trace ring, oldest entry first, as Synch_Trace_Send()
+ *  sends it after its two header bytes.
+ */
+void Engine_Trace(struct engine *e, unsigned char *trace)
+{
+    int i;
+
+    Enter(e);
+    for (i = 0; i < SYNCH_TRACE_SIZE * 4; i++)
+    {
+        trace[i] = synchTrace[(synchTraceHead + i) & (SYNCH_TRACE_SIZE * 4 - 1)];
+    }
+}
+#endif
+
+/*! \brief Relative error of the clock from TARGET_FREQUENCY. */
+double Engine_Clock_Error(struct engine *e)
+{
+    Enter(e);
+    return Frequency(e) / TARGET_FREQUENCY - 1.0;
+}
@@ -0,0 +1,78 @@
+/* This file has been prepared for Doxygen automatic documentation generation.*/
+/*! \file *********************************************************************
+ *
+ * \brief
+ *      Host model of one slave running the synchronization code.
+ *
+ *      An engine is one slave: an oscillator model, the Timer/Counter0 and
+ *      UART receiver models, and its own copy of the firmware state. Several
+ *      engines can be run against the same bus. See engine.c.
+ *
+ * \par Application note:
+ *      AVR054 Synchronization of the internal RC oscillator
+ *
+ ******************************************************************************/
+
+#if !defined(_ENGINE_H_)
+#define _ENGINE_H_
+
+// Bus level change, in seconds.
+struct edge
+{
+    double time;
+    int level;
+};
+
+// Events passed to the report function of an engine, after the interrupt
+// service routine has run.
+#define ENGINE_INT0         0   // value: count read by SYNCH_EXT_INT_ISR
+#define ENGINE_RX           1   // value: byte received
+#define ENGINE_FRAME_ERROR  2
+#define ENGINE_LOCK         3   // value: OSCCAL
+
+struct firmware_state;
+
+struct engine
+{
+    // Oscillator model:
+    // f = NOMINAL_FREQUENCY * (1 + error) * (1 + step * (OSCCAL - factory))
+    double error;
+    double step;
+    int factory;
+
+    // Time base.
+    double now;             // Seconds.
+    double cycles;          // CPU cycles since reset.
+    double timerStart;      // Cycle at which Timer/Counter0 was restarted.
+
+    // INT0 flag set by an edge while SYNCH_EXT_INT_ISR still ran. The routine
+    // is entered again when it has restarted the timer.
+    int int0Pending;
+
+    // UART receiver.
+    int rxBusy;
+    double rxTime;          // Stop bit sample of the character received.
+    int rxValue;            // -1 on a frame error.
+
+    // breakDetected after the last event, to report the end of each
+    // synchronization.
+    int calibrating;
+
+    void (*report)(struct engine *e, int event, int value);
+    void *user;
+
+    struct firmware_state *firmware;
+};
+
+void Engine_Init(struct engine *e, double error, double step, int factory);
+void Engine_Free(struct engine *e);
+void Engine_Run(struct engine *e, const struct edge *edges, int numEdges,
+                int initialLevel, double until);
+unsigned int Engine_Main_Loop(struct engine *e);
+unsigned char Engine_OSCCAL(struct engine *e);
+double Engine_Clock_Error(struct engine *e);
+#if defined(SYNCH_TRACE)
+void Engine_Trace(struct engine *e, unsigned char *trace);
+#endif
+
+#endif
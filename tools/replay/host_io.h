@@ -0,0 +1,99 @@
+/* This file has been prepared for Doxygen automatic documentation generation.*/
+/*! \file *********************************************************************
+ *
+ * \brief
+ *      ATtiny2313 I/O registers for host builds.
+ *
+ *      Included by compiler.h when SYNCH_HOST is defined. The registers are
+ *      bytes in hostIO[], at their data space addresses, so that the replay
+ *      harness can set the timer and UART registers before it calls an
+ *      interrupt service routine, and read OSCCAL and the interrupt control
+ *      registers after. Build with -D__AVR_ATtiny2313__ to select the
+ *      matching block in device_specific.h.
+ *
+ * \par Application note:
+ *      AVR054 Synchronization of the internal RC oscillator
+ *
+ ******************************************************************************/
+
+#if !defined(_HOST_IO_H_)
+#define _HOST_IO_H_
+
+extern volatile unsigned char hostIO[0x60];
+
+#define UBRRH     hostIO[0x22]
+#define UBRRL     hostIO[0x29]
+#define UCSRB     hostIO[0x2A]
+#define UCSRA     hostIO[0x2B]
+#define UDR       hostIO[0x2C]
+#define PIND      hostIO[0x30]
+#define DDRD      hostIO[0x31]
+#define PORTD     hostIO[0x32]
+#define DDRB      hostIO[0x37]
+#define PORTB     hostIO[0x38]
+#define EECR      hostIO[0x3C]
+#define EEDR      hostIO[0x3D]
+#define EEAR      hostIO[0x3E]
+#define OCR1A     hostIO[0x4A]
+#define TCCR1B    hostIO[0x4E]
+#define TCCR1A    hostIO[0x4F]
+#define TCCR0A    hostIO[0x50]
+#define OSCCAL    hostIO[0x51]
+#define TCNT0     hostIO[0x52]
+#define TCCR0B    hostIO[0x53]
+#define MCUCR     hostIO[0x55]
+#define OCR0A     hostIO[0x56]
+#define TIFR      hostIO[0x58]
+#define TIMSK     hostIO[0x59]
+#define EIFR      hostIO[0x5A]
+#define GIMSK     hostIO[0x5B]
+
+// UCSRA, UCSRB
+#define MPCM      0
+#define U2X       1
+#define FE        4
+#define TXEN      3
+#define RXEN      4
+#define RXCIE     7
+#define UDRE      5
+#define TXC       6
+
+// EECR
+#define EERE      0
+#define EEPE      1
+
+// TCCR0B, TCCR1A, TCCR1B
+#define CS00      0
+#define CS01      1
+#define CS02      2
+#define CS10      0
+#define CS11      1
+#define CS12      2
+#define WGM12     3
+#define COM1A0    6
+
+// TIFR, TIMSK
+#define OCF0A     0
+#define TOV0      1
+#define OCIE0A    0
+
+// MCUCR
+#define ISC00     0
+#define ISC01     1
+#define SM0       4
+#define SE        5
+#define SM1       6
+
+// GIMSK, EIFR
+#define INT0      6
+#define INTF0     6
+
+#define PB3       3
+#define PORTD2    2
+
+// The vectors only name the routines on the host.
+#define INT0_vect           0
+#define USART_RX_vect       0
+#define TIMER0_COMPA_vect   0
+
+#endif
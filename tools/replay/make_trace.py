@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+"""Generate a synthetic RX/INT0 trace in the frame format of test_node/test.c.
+
+Each frame is a BREAK, the SYNCH bytes (0x55) and one data byte, sent by a
+master with the given clock error. A list of SYNCH byte counts is used in
+turn, one per frame. Ringing adds short pulses of the opposite
+level after every edge, as seen on long or badly terminated buses. The
+output is a VCD file, or a sigrok-style CSV with one row per sample.
+
+The traces are meant as format examples and as repeatable input for the
+replay harness. They are not a substitute for captures from a real bus.
+"""
+
+import argparse
+import sys
+
+BREAK_S = 30000 / 8e6       # As in test.c at 8 MHz.
+DELIMITER_S = 1000 / 8e6
+GAP_S = 2e-3
+
+
+def frames(args):
+    """Return the edges as a list of (time in seconds, level)."""
+    bit = 1.0 / (args.baud * (1.0 + args.master_error / 1e6))
+    t = GAP_S
+    edges = []
+    counts = [int(n) for n in args.synch_bytes.split(',')]
+    for frame in range(args.frames):
+        edges.append((t, 0))
+        t += BREAK_S
+        edges.append((t, 1))
+        t += DELIMITER_S
+        synch_bytes = counts[frame % len(counts)]
+        data = (0xA5 + frame) & 0xFF
+        if synch_bytes == 1 and data == 0x55:
+            # Taken as a second SYNCH byte by the auto synch byte method.
+            data = 0xAA
+        values = [0x55] * synch_bytes + [data]
+        for value in values:
+            bits = [0] + [(value >> i) & 1 for i in range(8)] + [1]
+            level = 1
+            for i, b in enumerate(bits):
+                if b != level:
+                    edges.append((t + i * bit, b))
+                    level = b
+            t += 10 * bit
+        t += GAP_S
+    return ring(edges, args), t
+
+
+def ring(edges, args):
+    """Add ringing pulses after each edge."""
+    if args.ringing_ns <= 0:
+        return edges
+    width = args.ringing_ns * 1e-9
+    out = []
+    for i, (t, level) in enumerate(edges):
+        out.append((t, level))
+        limit = edges[i + 1][0] if i + 1 < len(edges) else float('inf')
+        for k in range(args.ringing_count):
+            start = t + (2 * k + 1) * width
+            if start + width < limit:
+                out.append((start, 1 - level))
+                out.append((start + width, level))
+    return out
+
+
+def write_vcd(f, edges, end, args):
+    f.write('$comment\n  Synthetic trace: %s\n$end\n' % describe(args))
+    f.write('$timescale 1 ns $end\n')
+    f.write('$scope module bus $end\n$var wire 1 ! RX $end\n$upscope $end\n')
+    f.write('$enddefinitions $end\n#0\n$dumpvars\n1!\n$end\n')
+    for t, level in edges:
+        f.write('#%d\n%d!\n' % (round(t * 1e9), level))
+    f.write('#%d\n' % round(end * 1e9))
+
+
+def write_csv(f, edges, end, args):
+    f.write('; Synthetic trace: %s\n' % describe(args))
+    f.write('; Samplerate: %g MHz\nRX\n' % (args.samplerate / 1e6))
+    level = 1
+    i = 0
+    for n in range(int(end * args.samplerate)):
+        t = n / args.samplerate
+        while i < len(edges) and edges[i][0] <= t:
+            level = edges[i][1]
+            i += 1
+        f.write('%d\n' % level)
+
+
+def describe(args):
+    return ('%d frames, %s SYNCH bytes, %d baud, master error %d ppm, '
+            'ringing %d x %d ns' % (args.frames, args.synch_bytes, args.baud,
+                                    args.master_error, args.ringing_count,
+                                    args.ringing_ns))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--frames', type=int, default=2)
+    parser.add_argument('--synch-bytes', default='1',
+                        help='SYNCH bytes per frame, or a comma separated '
+                             'list used in turn')
+    parser.add_argument('--baud', type=int, default=19200)
+    parser.add_argument('--master-error', type=int, default=0,
+                        help='master clock error, ppm')
+    parser.add_argument('--ringing-ns', type=int, default=0)
+    parser.add_argument('--ringing-count', type=int, default=2)
+    parser.add_argument('--csv', action='store_true')
+    parser.add_argument('--samplerate', type=float, default=1e6)
+    args = parser.parse_args()
+
+    edges, end = frames(args)
+    if args.csv:
+        write_csv(sys.stdout, edges, end, args)
+    else:
+        write_vcd(sys.stdout, edges, end, args)
+
+
+if __name__ == '__main__':
+    main()
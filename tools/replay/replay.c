@@ -0,0 +1,499 @@
+/* This file has been prepared for Doxygen automatic documentation generation.*/
+/*! \file *********************************************************************
+ *
+ * \brief
+ *      Replays a captured RX/INT0 trace through the interrupt service routines.
+ *
+ *      The trace is read from a VCD file or a sigrok/PulseView CSV export,
+ *      and run through one slave of the host model in engine.c, which
+ *      describes the oscillator, timer and UART models.
+ *
+ *      The output lists every INT0 interrupt with the count it read and the
+ *      OSCCAL value it left, every received byte, and every lock, followed by
+ *      a summary.
+ *
+ * \par Application note:
+ *      AVR054 Synchronization of the internal RC oscillator
+ *
+ ******************************************************************************/
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../../compiler.h"
+#include "../../online_synch.h"
+#include "engine.h"
+
+static struct edge *edges;
+static int numEdges;
+static int maxEdges;
+static int initialLevel = 1;
+
+// Oscillator model.
+static double oscError;
+static double oscStep = 0.007;
+static int oscFactory = 64;
+
+static int quiet;
+
+
+static void Add_Edge(double time, int level)
+{
+    int last = numEdges ? edges[numEdges - 1].level : initialLevel;
+
+    if (level == last)
+    {
+        return;
+    }
+    if (numEdges == maxEdges)
+    {
+        maxEdges = maxEdges ? 2 * maxEdges : 1024;
+        edges = realloc(edges, maxEdges * sizeof(*edges));
+        if (edges == NULL)
+        {
+            fprintf(stderr, "out of memory\n");
+            exit(2);
+        }
+    }
+    edges[numEdges].time = time;
+    edges[numEdges].level = level;
+    numEdges++;
+}
+
+/*! \brief Seconds per unit of a VCD $timescale, such as "10 ns". */
+static double Timescale(const char *text)
+{
+    static const struct
+    {
+        const char *unit;
+        double scale;
+    } units[] = {
+        { "fs", 1e-15 }, { "ps", 1e-12 }, { "ns", 1e-9 },
+        { "us", 1e-6 }, { "ms", 1e-3 }, { "s", 1.0 },
+    };
+    char unit[8];
+    double value;
+    unsigned int i;
+
+    if (sscanf(text, " %lf %7[a-z]", &value, unit) != 2)
+    {
+        return 1e-9;
+    }
+    for (i = 0; i < sizeof(units) / sizeof(units[0]); i++)
+    {
+        if (!strcmp(unit, units[i].unit))
+        {
+            return value * units[i].scale;
+        }
+    }
+    return 1e-9;
+}
+
+/*! \brief Read a VCD file.
+ *
+ *  The signal is selected by name, or the first 1-bit variable is used.
+ *  x and z read as high, the idle level of the bus.
+ */
+static int Read_VCD(FILE *f, const char *channel)
+{
+    char token[256];
+    char header[1024];
+    char name[128];
+    char id[32] = "";
+    char varId[32];
+    int width;
+    double scale = 1e-9;
+    double time = 0;
+    int started = 0;
+    char *value;
+
+    while (fscanf(f, "%255s", token) == 1)
+    {
+        if (!strcmp(token, "$timescale") || !strcmp(token, "$var"))
+        {
+            // Collect the declaration up to $end.
+            header[0] = '\0';
+            while ((fscanf(f, "%255s", token) == 1) && strcmp(token, "$end"))
+            {
+                if (strlen(header) + strlen(token) + 2 < sizeof(header))
+                {
+                    strcat(header, token);
+                    strcat(header, " ");
+                }
+            }
+            if (header[0] && !strncmp(token, "$end", 4) && strchr(header, ' '))
+            {
+                if (isdigit((unsigned char)header[0]))
+                {
+                    scale = Timescale(header);
+                }
+                else if ((sscanf(header, "%*s %d %31s %127s",
+                                 &width, varId, name) == 3) && (width == 1))
+                {
+                    if (channel ? !strcmp(name, channel) : !id[0])
+                    {
+                        strcpy(id, varId);
+                    }
+                }
+            }
+        }
+        else if (token[0] == '#')
+        {
+            time = atof(token + 1) * scale;
+        }
+        else if (!strcmp(token, "$dumpvars") || !strcmp(token, "$dumpall") ||
+                 !strcmp(token, "$dumpon") || !strcmp(token, "$dumpoff") ||
+                 !strcmp(token, "$end"))
+        {
+            continue;   // The values in these sections are read as usual.
+        }
+        else if (token[0] == '$')
+        {
+            // $comment, $scope and other sections are skipped.
+            while ((fscanf(f, "%255s", token) == 1) && strcmp(token, "$end"))
+            {
+            }
+        }
+        else if (id[0])
+        {
+            value = token;
+            if (token[0] == 'b')
+            {
+                // Vector form: "b1 id".
+                if (fscanf(f, "%255s", header) != 1)
+                {
+                    break;
+                }
+                if (strcmp(header, id))
+                {
+                    continue;
+                }
+                value = token + 1;
+            }
+            else if (strcmp(token + 1, id))
+            {
+                continue;
+            }
+            if (!started)
+            {
+                // The first value is the level at the start of the trace.
+                initialLevel = (value[0] != '0');
+                started = 1;
+            }
+            else
+            {
+                Add_Edge(time, value[0] != '0');
+            }
+        }
+    }
+    if (!id[0])
+    {
+        fprintf(stderr, "no 1-bit signal %s in trace\n", channel ? channel : "");
+        return -1;
+    }
+    return 0;
+}
+
+/*! \brief Read a sigrok/PulseView CSV export.
+ *
+ *  Comment lines start with ';'. If the first column is named "Time", it
+ *  holds the time in seconds. Otherwise there is one row per sample, at the
+ *  sample rate given with -r or in a "Samplerate:" comment.
+ */
+static int Read_CSV(FILE *f, const char *channel, double samplerate)
+{
+    char line[1024];
+    char *field;
+    char unit[8];
+    double rate;
+    double time;
+    int column = -1;
+    int timeColumn = 0;
+    int started = 0;
+    long sample = 0;
+    int i;
+
+    while (fgets(line, sizeof(line), f))
+    {
+        if ((line[0] == ';') || (line[0] == '#'))
+        {
+            field = strstr(line, "Samplerate:");
+            if (field && (samplerate == 0) &&
+                (sscanf(field + 11, " %lf %7s", &rate, unit) >= 1))
+            {
+                samplerate = rate * ((unit[0] == 'M') ? 1e6 :
+                                     (unit[0] == 'k') ? 1e3 :
+                                     (unit[0] == 'G') ? 1e9 : 1.0);
+            }
+            continue;
+        }
+        if (column < 0)
+        {
+            if (isdigit((unsigned char)line[0]) || (line[0] == '-'))
+            {
+                // No header: the signal is in the last column.
+                column = 0;
+                for (field = line; *field; field++)
+                {
+                    column += (*field == ',');
+                }
+                timeColumn = 0;
+            }
+            else
+            {
+                timeColumn = !strncmp(line, "Time", 4) ||
+                             !strncmp(line, "time", 4);
+                column = timeColumn ? 1 : 0;
+                field = strtok(line, ",\r\n");
+                for (i = 0; field; i++, field = strtok(NULL, ",\r\n"))
+                {
+                    while (*field == ' ')
+                    {
+                        field++;
+                    }
+                    if (channel && !strcmp(field, channel))
+                    {
+                        column = i;
+                    }
+                }
+                continue;
+            }
+        }
+
+        time = timeColumn ? atof(line) : 0;
+        if (!timeColumn)
+        {
+            if (samplerate == 0)
+            {
+                fprintf(stderr, "unknown sample rate, use -r\n");
+                return -1;
+            }
+            time = sample++ / samplerate;
+        }
+        field = line;
+        for (i = 0; (i < column) && field; i++)
+        {
+            field = strchr(field, ',');
+            field = field ? field + 1 : NULL;
+        }
+        if (field == NULL)
+        {
+            continue;
+        }
+        if (!started)
+        {
+            initialLevel = (atoi(field) != 0);
+            started = 1;
+        }
+        else
+        {
+            Add_Edge(time, atoi(field) != 0);
+        }
+    }
+    return 0;
+}
+
+
+// Counts for the summary.
+static int locks;
+static int bytes;
+static int frameErrors;
+static unsigned char lastOSCCAL;
+
+static void Report(struct engine *e, int event, int value)
+{
+    unsigned char osccal = Engine_OSCCAL(e);
+
+    switch (event)
+    {
+        case ENGINE_INT0:
+            if (!quiet)
+            {
+                printf("%12.1f us  INT0  count %3d  OSCCAL 0x%02X%s\n",
+                       e->now * 1e6, value, osccal,
+                       (osccal != lastOSCCAL) ? " *" : "");
+            }
+            break;
+        case ENGINE_RX:
+            bytes++;
+            if (!quiet)
+            {
+                printf("%12.1f us  RX    0x%02X\n", e->now * 1e6, value);
+            }
+            break;
+        case ENGINE_FRAME_ERROR:
+            frameErrors++;
+            if (!quiet)
+            {
+                printf("%12.1f us  RX    frame error\n", e->now * 1e6);
+            }
+            break;
+        case ENGINE_LOCK:
+            locks++;
+            if (!quiet)
+            {
+                printf("%12.1f us  lock  OSCCAL 0x%02X  error %+.2f %%\n",
+                       e->now * 1e6, value, Engine_Clock_Error(e) * 100.0);
+            }
+            break;
+    }
+    lastOSCCAL = osccal;
+}
+
+#if defined(SYNCH_TRACE)
+/*! \brief Print the trace ring, decoded as by tools/trace_dump.py. */
+static void Print_Trace(struct engine *e)
+{
+    static const char *const states[] = {
+        "measure", "binary", "neighbor", "verify"
+    };
+    unsigned char trace[SYNCH_TRACE_SIZE * 4];
+    unsigned char state;
+    int i;
+
+    Engine_Trace(e, trace);
+    for (i = 0; i < SYNCH_TRACE_SIZE * 4; i += 4)
+    {
+        state = trace[i] & 0x7F;
+        if (state == SS_TRACE_BREAK)
+        {
+            printf("# trace break     OSCCAL 0x%02X  step %3d\n",
+                   trace[i + 1], trace[i + 3]);
+        }
+        else
+        {
+            printf("# trace %-9s OSCCAL 0x%02X  step %3d  count %3d\n",
+                   (state < 4) ? states[state] : "?", trace[i + 1],
+                   trace[i + 3], ((trace[i] & 0x80) << 1) | trace[i + 2]);
+        }
+    }
+}
+#endif
+
+static void Usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [options] trace.vcd|trace.csv\n"
+            "  -c name        signal name in the trace (first 1-bit signal)\n"
+            "  -r rate        sample rate of a CSV without time column, Hz\n"
+            "  -e percent     oscillator error at the factory OSCCAL (0)\n"
+            "  -s permille    frequency change per OSCCAL step (7)\n"
+            "  -o value       factory OSCCAL value (64)\n"
+            "  -q             print the summary only\n"
+            "  -t             print the replay speed to stderr\n",
+            name);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *channel = NULL;
+    const char *path = NULL;
+    double samplerate = 0;
+    int timing = 0;
+    FILE *f;
+    size_t length;
+    int result;
+    int i;
+    struct engine slave;
+    clock_t start;
+
+    for (i = 1; i < argc; i++)
+    {
+        if ((argv[i][0] == '-') && (argv[i][1] == 'q'))
+        {
+            quiet = 1;
+        }
+        else if ((argv[i][0] == '-') && (argv[i][1] == 't'))
+        {
+            timing = 1;
+        }
+        else if ((argv[i][0] == '-') && argv[i][1] && (i + 1 < argc))
+        {
+            switch (argv[i][1])
+            {
+                case 'c': channel = argv[++i]; break;
+                case 'r': samplerate = atof(argv[++i]); break;
+                case 'e': oscError = atof(argv[++i]) / 100.0; break;
+                case 's': oscStep = atof(argv[++i]) / 1000.0; break;
+                case 'o': oscFactory = strtol(argv[++i], NULL, 0); break;
+                default: Usage(argv[0]); return 2;
+            }
+        }
+        else
+        {
+            path = argv[i];
+        }
+    }
+    if (path == NULL)
+    {
+        Usage(argv[0]);
+        return 2;
+    }
+    f = fopen(path, "r");
+    if (f == NULL)
+    {
+        perror(path);
+        return 2;
+    }
+    length = strlen(path);
+    if ((length > 4) && !strcmp(path + length - 4, ".csv"))
+    {
+        result = Read_CSV(f, channel, samplerate);
+    }
+    else
+    {
+        result = Read_VCD(f, channel);
+    }
+    fclose(f);
+    if (result)
+    {
+        return 2;
+    }
+
+    Engine_Init(&slave, oscError, oscStep, oscFactory);
+    slave.report = Report;
+    lastOSCCAL = Engine_OSCCAL(&slave);
+
+    printf("# %s: %d edges, error %+.2f %%, %s, %d-bit timer\n", path,
+           numEdges, oscError * 100.0,
+#if defined(SYNCH_METHOD_DOUBLE_SYNCH_BYTE)
+           "double synch byte",
+#elif defined(SYNCH_METHOD_AUTO_SYNCH_BYTE)
+           "auto synch byte",
+#elif defined(SYNCH_VERIFY)
+           "single synch byte, verified",
+#elif defined(SYNCH_FILTER)
+           "single synch byte, filtered",
+#else
+           "single synch byte",
+#endif
+#if defined(NINE_BIT_TIMER)
+           9
+#else
+           8
+#endif
+           );
+
+    // The last character ends well within a second after the last edge.
+    start = clock();
+    Engine_Run(&slave, edges, numEdges, initialLevel,
+               numEdges ? edges[numEdges - 1].time + 1.0 : 0.0);
+
+    printf("# locks %d, bytes %d, frame errors %d, OSCCAL 0x%02X, "
+           "error %+.2f %%\n", locks, bytes, frameErrors,
+           Engine_OSCCAL(&slave), Engine_Clock_Error(&slave) * 100.0);
+#if defined(SYNCH_TRACE)
+    Print_Trace(&slave);
+#endif
+    if (timing)
+    {
+        fprintf(stderr, "%s: %d edges in %.3f s\n", path, numEdges,
+                (double)(clock() - start) / CLOCKS_PER_SEC);
+    }
+    Engine_Free(&slave);
+    free(edges);
+    return 0;
+}
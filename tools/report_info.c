@@ -0,0 +1,69 @@
+/* This file has been prepared for Doxygen automatic documentation generation.*/
+/*! \file *********************************************************************
+ *
+ * \brief
+ *      Symbol information for the build report and the simulator.
+ *
+ *      This file is not compiled. The Makefile runs it through the
+ *      preprocessor with the flags of each build. tools/avr_report.py reads
+ *      the result to find the interrupt vectors and the Timer/Counter0
+ *      registers in the disassembly, and tools/sim_slave.c reads the register
+ *      addresses and the configuration it needs to drive the firmware.
+ *
+ * \par Application note:
+ *      AVR054 Synchronization of the internal RC oscillator
+ *
+ ******************************************************************************/
+
+#include "../compiler.h"
+#include "../online_synch.h"
+
+REPORT_VECTOR SYNCH_EXT_INT_ISR SYNCH_EDGE_vect
+REPORT_VECTOR UART_RXC_ISR SYNCH_USART_RXC_vect
+#if defined(SYNCH_TIMEOUT)
+REPORT_VECTOR SYNCH_TIMEOUT_ISR SYNCH_TIMER_COMPARE_vect
+#endif
+
+REPORT_SFR TIMER_COUNT TCNT0
+REPORT_SFR TIMER_PRESCALER SYNCH_TIMER_PRESCALER_REGISTER
+#if defined(NINE_BIT_TIMER)
+REPORT_TIMER_BITS 9
+#else
+REPORT_TIMER_BITS 8
+#endif
+REPORT_READ_DELAY COUNTER_READ_DELAY
+
+// Used by the simavr harness, tools/sim_slave.c.
+REPORT_SFR CALIBRATION OSCCAL
+REPORT_SFR OUTPUT_PORT PORTB
+REPORT_SFR UART_CONTROL SYNCH_USART_STATCTRL_REG_B
+REPORT_SFR UART_STATUS SYNCH_USART_STATCTRL_REG_A
+REPORT_VALUE RX_ENABLE_BIT SYNCH_RXEN
+REPORT_VALUE FRAME_ERROR_BIT SYNCH_FE
+REPORT_VALUE NOMINAL NOMINAL_FREQUENCY
+REPORT_VALUE TARGET TARGET_FREQUENCY
+REPORT_VALUE BAUD SYNCH_FREQUENCY
+REPORT_VALUE UBRR SYNCH_UBRR
+REPORT_VALUE UART_DIVISOR SYNCH_UART_DIVISOR
+REPORT_VALUE EEPROM_ADDRESS DEFAULT_OSCCAL_ADDRESS
+#if defined(SYNCH_METHOD_DOUBLE_SYNCH_BYTE) & defined(SYNCH_INTERPOLATE)
+REPORT_VALUE ACCURACY_PERMILLE OSCCAL_STEP_PERMILLE
+REPORT_VALUE SYNCH_BYTES 1
+#elif defined(SYNCH_METHOD_DOUBLE_SYNCH_BYTE)
+REPORT_VALUE ACCURACY_PERMILLE OSCCAL_STEP_PERMILLE
+REPORT_VALUE SYNCH_BYTES 2
+#elif defined(SYNCH_METHOD_AUTO_SYNCH_BYTE)
+REPORT_VALUE ACCURACY_PERMILLE SYNCH_ACCURACY
+REPORT_VALUE SYNCH_BYTES 2
+#elif defined(SYNCH_VERIFY)
+REPORT_VALUE ACCURACY_PERMILLE SYNCH_ACCURACY
+REPORT_VALUE SYNCH_BYTES 2
+#else
+REPORT_VALUE ACCURACY_PERMILLE SYNCH_ACCURACY
+REPORT_VALUE SYNCH_BYTES 1
+#endif
+#if defined(SYNCH_FILTER)
+REPORT_VALUE SAMPLES SYNCH_SAMPLES
+#else
+REPORT_VALUE SAMPLES 1
+#endif
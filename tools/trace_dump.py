@@ -0,0 +1,71 @@
+#!/usr/bin/env python3
+"""Decode the calibration trace sent by Synch_Trace_Send().
+
+The input is the raw bytes received from the slave after SYNCH_TRACE_COMMAND,
+for example captured with a terminal program to a file. The first byte is
+the number of entries, the second the OSCCAL value at the time of sending,
+followed by the entries, oldest first, four bytes each:
+
+    synchState, with bit 8 of the count in bit 7
+    OSCCAL before the step
+    bits 7..0 of the count
+    calStep
+
+A BREAK entry starts each synchronization. Its OSCCAL value is the result of
+the synchronization before it, and its step is nonzero if that one was
+interrupted by the BREAK. The output uses the format of the trace lines of
+the replay harness, tools/replay/replay.c, so a field trace can be compared
+with a replay.
+"""
+
+import argparse
+import sys
+
+SS_TRACE_BREAK = 0x0F
+STATES = ['measure', 'binary', 'neighbor', 'verify']
+
+
+def decode(data):
+    """Return the OSCCAL value and the list of entry lines."""
+    if len(data) < 2:
+        raise ValueError('no trace header')
+    size, osccal = data[0], data[1]
+    entries = data[2:2 + 4 * size]
+    if len(entries) < 4 * size:
+        # A BREAK ends the transfer early.
+        entries = entries[:len(entries) - len(entries) % 4]
+    lines = []
+    for i in range(0, len(entries), 4):
+        state = entries[i] & 0x7F
+        if state == SS_TRACE_BREAK:
+            lines.append('# trace break     OSCCAL 0x%02X  step %3d'
+                         % (entries[i + 1], entries[i + 3]))
+        else:
+            name = STATES[state] if state < len(STATES) else '?'
+            count = ((entries[i] & 0x80) << 1) | entries[i + 2]
+            lines.append('# trace %-9s OSCCAL 0x%02X  step %3d  count %3d'
+                         % (name, entries[i + 1], entries[i + 3], count))
+    return osccal, lines
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('dump', nargs='?', help='raw trace bytes (stdin)')
+    args = parser.parse_args()
+
+    if args.dump:
+        with open(args.dump, 'rb') as f:
+            data = f.read()
+    else:
+        data = sys.stdin.buffer.read()
+    try:
+        osccal, lines = decode(data)
+    except ValueError as e:
+        sys.exit('%s: %s' % (args.dump or 'stdin', e))
+    print('# OSCCAL 0x%02X, %d entries' % (osccal, len(lines)))
+    for line in lines:
+        print(line)
+
+
+if __name__ == '__main__':
+    main()